@@ -35,36 +35,116 @@ static inline void *safe_align(size_t siz, size_t ali, bool clear)
 	return mem;
 }
 
+/* Two level bitmap: bit k of data is slot k (1: in use), bit i of
+   summary[w] is set when data word w*64+i is full. get_free descends
+   summary -> data with ctz, so finding a free bit is a couple of word reads
+   at any size, starting from the summary word of the last hit (hint).
+   summary is maintained after the data words and may lag for an instant;
+   get_free only trusts it as a hint and falls back to a scan.
+   Layout: 16B header, summary[sum_words], data[words]. A bitmap can live in
+   memory of the caller (init_bitmap on bitmap_bytes(cnt) bytes, eg. inline
+   in a Page), create_bitmap allocates it. */
 struct bitmap
 {
-	unsigned long cnt, free_cnt, siz;
-	unsigned long data[0];
+	unsigned int free_cnt;
+	unsigned int words, sum_words;
+	unsigned int hint; // 上次分配到的summary word
+	unsigned long sum[0]; // summary[0, sum_words) 后面是 data[0, words)
 };
 
-// bitmap大小不要超过100000,否则性能很差
-static inline struct bitmap *create_bitmap(unsigned long cnt)
+static inline unsigned long *bitmap_summary(struct bitmap *bp)
+{
+	return bp->sum;
+}
+
+static inline unsigned long *bitmap_data(struct bitmap *bp)
+{
+	return bp->sum + bp->sum_words;
+}
+
+static constexpr unsigned long bitmap_words(unsigned long cnt)
+{
+	return ALIGN_UP(cnt, 64) / 64;
+}
+
+static constexpr unsigned long bitmap_sum_words(unsigned long cnt)
 {
-	struct bitmap *bp;
-	unsigned long siz;
-	siz = ALIGN_UP(cnt, 64);
-	bp = (struct bitmap *)safe_align(sizeof(bitmap) + (siz / 64) * sizeof(unsigned long), CL_SIZE, true);
-	bp->cnt = cnt;
+	return ALIGN_UP(bitmap_words(cnt), 64) / 64;
+}
+
+static constexpr size_t bitmap_bytes(unsigned long cnt)
+{
+	return sizeof(bitmap) + (bitmap_words(cnt) + bitmap_sum_words(cnt)) * sizeof(unsigned long);
+}
+
+/* Format bitmap_bytes(cnt) bytes at bp as a bitmap of cnt free bits. */
+static inline void init_bitmap(struct bitmap *bp, unsigned long cnt)
+{
+	unsigned long words = bitmap_words(cnt), sum_words = bitmap_sum_words(cnt);
+	memset(bp, 0, sizeof(bitmap) + (words + sum_words) * sizeof(unsigned long));
 	bp->free_cnt = cnt;
-	for (unsigned long i = cnt; i < siz; i++)
-		bp->data[i >> 6] |= 1UL << (i & 63);
-	bp->siz = siz;
+	bp->words = words;
+	bp->sum_words = sum_words;
+	unsigned long *data = bitmap_data(bp);
+	for (unsigned long i = cnt; i < words * 64; i++)
+		data[i >> 6] |= 1UL << (i & 63);
+	unsigned long *sum = bitmap_summary(bp);
+	for (unsigned long w = words; w < sum_words * 64; w++) // 不存在的word视为满
+		sum[w >> 6] |= 1UL << (w & 63);
+}
+
+static inline struct bitmap *create_bitmap(unsigned long cnt)
+{
+	struct bitmap *bp = (struct bitmap *)safe_align(bitmap_bytes(cnt), CL_SIZE, false);
+	init_bitmap(bp, cnt);
 	return bp;
 }
 
+static inline void free_bitmap(struct bitmap *bp)
+{
+	free(bp);
+}
+
 static inline bool bitmap_full(struct bitmap *bp)
 {
 	return bp->free_cnt == 0;
 }
 
-static inline int get_free(struct bitmap *bp)
+/* Word w just became full: set its summary bit. A put_back may have freed a
+   bit in between and already cleared the summary bit, so re-check the word
+   and undo; this way a word with a free bit is never left marked full. */
+static inline void bitmap_mark_full(struct bitmap *bp, unsigned long w)
+{
+	unsigned long *sum = bitmap_summary(bp);
+	__sync_fetch_and_or(&sum[w >> 6], 1UL << (w & 63));
+	if (bitmap_data(bp)[w] != (unsigned long)-1)
+		__sync_fetch_and_and(&sum[w >> 6], ~(1UL << (w & 63)));
+}
+
+/* Claim a free bit of word w, -1 if the word is full. */
+static inline long bitmap_claim_word(struct bitmap *bp, unsigned long w)
 {
-	unsigned long tot, i, ii, j;
-	unsigned long old_free_cnt, old_val;
+	unsigned long *data = bitmap_data(bp);
+	unsigned long old_val, j;
+	for (;;)
+	{
+		old_val = data[w];
+		if (old_val == (unsigned long)-1)
+			return -1;
+		j = __builtin_ctzl(~old_val);
+		if (cmpxchg(&data[w], old_val, old_val | (1UL << j)))
+		{
+			if ((old_val | (1UL << j)) == (unsigned long)-1)
+				bitmap_mark_full(bp, w);
+			return (long)((w << 6) | j);
+		}
+	}
+}
+
+// hint: 调用者(线程)自己的搜索起点, 为空时用bitmap内共享的hint
+static inline int get_free(struct bitmap *bp, unsigned int *hint = nullptr)
+{
+	unsigned int old_free_cnt;
 	do
 	{
 		old_free_cnt = bp->free_cnt;
@@ -72,32 +152,52 @@ static inline int get_free(struct bitmap *bp)
 			return -1;
 	} while (unlikely(!cmpxchg(&bp->free_cnt, old_free_cnt, old_free_cnt - 1)));
 
-	tot = bp->siz / 64;
-	for (i = 0; i < tot; i++)
+	unsigned long *sum = bitmap_summary(bp);
+	unsigned int *h = hint ? hint : &bp->hint;
+	unsigned long start = __atomic_load_n(h, __ATOMIC_RELAXED);
+	if (unlikely(start >= bp->sum_words))
+		start = 0;
+	for (unsigned long n = 0, k = start; n < bp->sum_words; n++, k = (k + 1 == bp->sum_words) ? 0 : k + 1)
+	{
+		unsigned long s;
+		while ((s = sum[k]) != (unsigned long)-1)
+		{
+			unsigned long w = (k << 6) | __builtin_ctzl(~s);
+			long r = bitmap_claim_word(bp, w);
+			if (r >= 0)
+			{
+				if (k != start)
+					__atomic_store_n(h, k, __ATOMIC_RELAXED);
+				return (int)r;
+			}
+			bitmap_mark_full(bp, w); // summary落后了, 补上
+		}
+	}
+	// 已预留了free_cnt, 一定有空位; summary 瞬时不准时逐个word找
+	for (;;)
 	{
-		for (;;)
+		for (unsigned long w = 0; w < bp->words; w++)
 		{
-			old_val = bp->data[i];
-			if (old_val == (unsigned long)-1)
-				break;
-			j = __builtin_ffsl(old_val + 1) - 1;
-			if (cmpxchg(&bp->data[i], old_val, old_val | (1UL << j)))
-				return (i << 6) | j;
+			long r = bitmap_claim_word(bp, w);
+			if (r >= 0)
+				return (int)r;
 		}
 	}
-	assert(false);
-	return 0;
 }
 
-static inline void put_back(struct bitmap *bp, int bk)
+// 返回释放后的free_cnt
+static inline unsigned int put_back(struct bitmap *bp, int bk)
 {
+	unsigned long *data = bitmap_data(bp);
 	unsigned long old_val;
-	assert((bp->data[bk >> 6] >> (bk & 63)) & 1);
+	assert((data[bk >> 6] >> (bk & 63)) & 1);
 	do
 	{
-		old_val = bp->data[bk >> 6];
-	} while (unlikely(!cmpxchg(&bp->data[bk >> 6], old_val, old_val ^ (1UL << (bk & 63)))));
-	atomic_inc(&bp->free_cnt);
+		old_val = data[bk >> 6];
+	} while (unlikely(!cmpxchg(&data[bk >> 6], old_val, old_val ^ (1UL << (bk & 63)))));
+	if (old_val == (unsigned long)-1)
+		__sync_fetch_and_and(&bitmap_summary(bp)[bk >> 12], ~(1UL << ((bk >> 6) & 63)));
+	return atomic_inc(&bp->free_cnt);
 }
 
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include "rdma_conn_manager.h"
 #include "rdma_mem_pool.h"
 #include "rwlock.h"
+#include "tinylfu.h"
 
 namespace kv {
 
@@ -43,6 +44,9 @@ class ClockCache {
 
         bool Insert(uint64_t addr, uint32_t rkey, uint32_t offset, uint32_t size, const char *str) {
             Node *node = nullptr;
+#ifdef USE_TINYLFU
+            filter_.record(addr);
+#endif
             hash_map_lock_.lock_reader();
             auto iter = hash_map_.find(addr);
             if (iter != hash_map_.end()) {
@@ -68,6 +72,13 @@ class ClockCache {
                 hash_map_lock_.unlock_writer();
 
                 node->lock_.lock_writer();
+#ifdef USE_TINYLFU
+                if (!Admit(addr, node)) {
+                    bool ret = WriteThrough(addr, rkey, offset, size, str);
+                    node->lock_.unlock_writer();
+                    return ret;
+                }
+#endif
                 visited[free_slot] = true;
                 if (node->dirty_) {
                     bool ret = node->remote_write(rdma_);
@@ -94,6 +105,13 @@ ffff:
                 if (node->key_ == addr) {
                     memcpy(node->value_ + offset, str, size);
                 } else {
+#ifdef USE_TINYLFU
+                    if (!Admit(addr, node)) {
+                        bool ret = WriteThrough(addr, rkey, offset, size, str);
+                        node->lock_.unlock_writer();
+                        return ret;
+                    }
+#endif
                     // if dirty, flush
                     if (node->dirty_) {
                         bool ret = node->remote_write(rdma_);
@@ -120,6 +138,9 @@ ffff:
         bool Find(uint64_t addr, uint32_t rkey, uint32_t offset, uint32_t size, char *str) {
             // printf("should not be here\n");
             Node *node = nullptr;
+#ifdef USE_TINYLFU
+            filter_.record(addr);
+#endif
             hash_map_lock_.lock_reader();
             auto iter = hash_map_.find(addr);
             if (iter != hash_map_.end()) {
@@ -144,8 +165,16 @@ ffff:
                     
                 hash_map_lock_.unlock_writer();
 
-                visited[free_slot] = true;
+                misses_.fetch_add(1, std::memory_order_relaxed);
                 node->lock_.lock_writer();
+#ifdef USE_TINYLFU
+                if (!Admit(addr, node)) {
+                    bool ret = ReadThrough(addr, rkey, offset, size, str);
+                    node->lock_.unlock_writer();
+                    return ret;
+                }
+#endif
+                visited[free_slot] = true;
                 if (node->dirty_) {
                     bool ret = node->remote_write(rdma_);
                     if (ret) {
@@ -171,6 +200,7 @@ fffind:
                 if (node->key_ == addr) {
                     memcpy(str, node->value_ + offset, size);
                     node->lock_.unlock_reader();
+                    hits_.fetch_add(1, std::memory_order_relaxed);
                 } else {
                     node->lock_.unlock_reader();
                     node->lock_.lock_writer();
@@ -178,8 +208,17 @@ fffind:
                     if (node->key_ == addr) {
                         memcpy(str, node->value_ + offset, size);
                         node->lock_.unlock_writer();
+                        hits_.fetch_add(1, std::memory_order_relaxed);
                         return true;
                     }
+                    misses_.fetch_add(1, std::memory_order_relaxed);
+#ifdef USE_TINYLFU
+                    if (!Admit(addr, node)) {
+                        bool ret = ReadThrough(addr, rkey, offset, size, str);
+                        node->lock_.unlock_writer();
+                        return ret;
+                    }
+#endif
                     // if dirty, flush
                     if (node->dirty_) {
                         bool ret = node->remote_write(rdma_);
@@ -203,7 +242,57 @@ fffind:
             return true;
         }
 
+        /* 丢弃addr对应的cacheline, 不写回: 它所在的remote内存要还回去了 */
+        void Invalidate(uint64_t addr) {
+            Node *node = nullptr;
+            hash_map_lock_.lock_writer();
+            auto iter = hash_map_.find(addr);
+            if (iter != hash_map_.end()) {
+                node = iter->second;
+                hash_map_.erase(iter);
+            }
+            hash_map_lock_.unlock_writer();
+            if (nullptr == node) return;
+            node->lock_.lock_writer();
+            if (node->key_ == addr) {
+                node->key_ = 0;
+                node->dirty_ = false;
+                visited[node->ring_slot_id_] = false;
+            }
+            node->lock_.unlock_writer();
+        }
+
+        /* Find 的命中/未命中次数 */
+        void stats(uint64_t &hits, uint64_t &misses) {
+            hits = hits_.load();
+            misses = misses_.load();
+        }
+
     private:
+#ifdef USE_TINYLFU
+        /* 读入addr要换掉node中的line, 由TinyLFU决定是否值得; 调用者持有node的写锁 */
+        bool Admit(uint64_t addr, Node *node) {
+            return 0 == node->key_ || filter_.admit(addr, node->key_);
+        }
+
+        /* 没有被接纳的line不在cache中(addr只映射到这个node, 持有它的锁), remote上的就是最新的 */
+        bool ReadThrough(uint64_t addr, uint32_t rkey, uint32_t offset, uint32_t size, char *str) {
+            if (rdma_->remote_read(str, size, addr + offset, rkey)) {
+                printf("remote read error\n");
+                return false;
+            }
+            return true;
+        }
+
+        bool WriteThrough(uint64_t addr, uint32_t rkey, uint32_t offset, uint32_t size, const char *str) {
+            if (rdma_->remote_write((void *)str, size, addr + offset, rkey)) {
+                printf("remote write error\n");
+                return false;
+            }
+            return true;
+        }
+#endif
+
         int get_free_node() {
             int old_pos = clock_ptr;
             clock_ptr++;
@@ -230,6 +319,11 @@ fffind:
         Node *ring_;
         bool visited[CACHELINE_NUMS]; // used for clock evict, when is visited, turn to true
         std::atomic<int> clock_ptr;  // clock指针先使用中心化的atomic_int试一下有无瓶颈
+        std::atomic<uint64_t> hits_{0};
+        std::atomic<uint64_t> misses_{0};
+#ifdef USE_TINYLFU
+        TinyLFU filter_{CACHELINE_NUMS};
+#endif
 };
 
 
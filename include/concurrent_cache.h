@@ -0,0 +1,282 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include "rdma_conn_manager.h"
+#include "rdma_mem_pool.h"
+#include "rwlock.h"
+#include "spinlock.h"
+
+#define CACHE_COUNTER_SLOTS 16 // 命中/未命中计数按线程分散到这么多个cacheline上
+
+namespace kv {
+
+/* A cache line of ConcurrentClockCache. key_ changes only while both lock_
+   (writer) and the cache's map lock are held, so a reader that sees its
+   addr in key_ within one stable version of lock_ copied the data of that
+   addr. */
+struct alignas(64) ClockLine {
+  std::atomic<uint64_t> key_{0}; // cacheline start addr, 0: 空
+  std::atomic<uint8_t> ref_{0};  // CLOCK 访问位, 命中时置位, 指针扫过时清零
+  bool dirty_ = false;
+  uint32_t rkey_ = 0;
+  char *value_ = nullptr;
+  seq_lock lock_; // 写者互斥地改 value_/dirty_/rkey_ 和换入换出, 读者只比较版本号
+};
+
+/* CLOCK cache whose read hits take no lock: the line is found through an
+   open addressing table read without locks and its content is copied
+   optimistically, seqlock style: the copy is kept if the line's version
+   was even and unchanged around it, else it is retried. The only stores of
+   a read hit are the access bit, a relaxed store done only if the hand has
+   cleared it, and the thread's own hit counter, so hits on one line do not
+   bounce its cacheline between readers. Insert copies under the line's
+   writer lock.
+   A miss takes a victim with the CLOCK hand, a fetch_add on an atomic
+   counter: a line whose access bit is set gets a second chance, a line that
+   is locked is skipped, the first other line is claimed by try-locking it.
+   Concurrent misses move the hand together and claim different lines. The
+   victim is written back while its old addr is still mapped (accesses to
+   the old addr wait for the line lock), then the table is switched to the
+   new addr under map_lock_ and the line is read in. map_lock_ serializes
+   only the table updates, never RDMA.
+   Lock order: line lock, then map_lock_. Same interface as LRUCache and
+   ClockCache (USE_CONCURRENT_CACHE). */
+class ConcurrentClockCache {
+ public:
+  ConcurrentClockCache(uint32_t line_num, ConnectionManager *rdma_conn) : line_num_(line_num), rdma_(rdma_conn) {
+    lines_ = new ClockLine[line_num_];
+    for (uint32_t i = 0; i < line_num_; i++) {
+      lines_[i].value_ = new char[CACHELINE_SIZE];
+    }
+    // 装载率不超过1/4, 探测链短, 无锁读也一定能碰到空位停下
+    table_size_ = 64;
+    while (table_size_ < line_num_ * 4) table_size_ <<= 1;
+    table_ = new std::atomic<uint32_t>[table_size_];
+    for (uint32_t i = 0; i < table_size_; i++) table_[i].store(0, std::memory_order_relaxed);
+  }
+
+  ~ConcurrentClockCache() {
+    for (uint32_t i = 0; i < line_num_; i++) delete[] lines_[i].value_;
+    delete[] lines_;
+    delete[] table_;
+  }
+
+  ConcurrentClockCache(const ConcurrentClockCache &) = delete;
+  ConcurrentClockCache &operator=(const ConcurrentClockCache &) = delete;
+
+  bool Insert(uint64_t addr, uint32_t rkey, uint32_t offset, uint32_t size, const char *str) {
+    for (;;) {
+      ClockLine *line = Lookup(addr);
+      if (line != nullptr) {
+        line->lock_.lock_writer();
+        if (line->key_.load(std::memory_order_relaxed) == addr) {
+          memcpy(line->value_ + offset, str, size);
+          line->dirty_ = true;
+          line->lock_.unlock_writer();
+          Touch(line);
+          return true;
+        }
+        line->lock_.unlock_writer();
+      }
+      bool retry = false;
+      line = Load(addr, rkey, retry);
+      if (line == nullptr) {
+        if (retry) continue;
+        return false;
+      }
+      memcpy(line->value_ + offset, str, size);
+      line->dirty_ = true;
+      line->lock_.unlock_writer();
+      Touch(line);
+      return true;
+    }
+  }
+
+  bool Find(uint64_t addr, uint32_t rkey, uint32_t offset, uint32_t size, char *str) {
+    for (;;) {
+      ClockLine *line = Lookup(addr);
+      if (line != nullptr) {
+        uint32_t version = line->lock_.read_begin();
+        if (line->key_.load(std::memory_order_relaxed) == addr) {
+          memcpy(str, line->value_ + offset, size);
+          if (line->lock_.read_retry(version)) continue; // 拷贝期间被写过或换出, 重来
+          Touch(line);
+          Counter().hits_.fetch_add(1, std::memory_order_relaxed);
+          return true;
+        }
+        if (line->lock_.read_retry(version)) continue;
+      }
+      bool retry = false;
+      line = Load(addr, rkey, retry);
+      if (line == nullptr) {
+        if (retry) continue;
+        return false;
+      }
+      memcpy(str, line->value_ + offset, size);
+      line->lock_.unlock_writer();
+      Touch(line);
+      Counter().misses_.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+
+  /* 丢弃addr对应的cacheline, 不写回: 它所在的remote内存要还回去了 */
+  void Invalidate(uint64_t addr) {
+    for (;;) {
+      map_lock_.lock();
+      ClockLine *line = Lookup(addr);
+      map_lock_.unlock();
+      if (line == nullptr) return;
+      line->lock_.lock_writer();
+      if (line->key_.load(std::memory_order_relaxed) == addr) {
+        map_lock_.lock();
+        Erase(addr);
+        line->key_.store(0, std::memory_order_relaxed);
+        map_lock_.unlock();
+        line->dirty_ = false;
+        line->ref_.store(0, std::memory_order_relaxed);
+        line->lock_.unlock_writer();
+        return;
+      }
+      // 刚被换出, 可能又被换入到别的line, 再查一次
+      line->lock_.unlock_writer();
+    }
+  }
+
+  /* Find 的命中/未命中次数 */
+  void stats(uint64_t &hits, uint64_t &misses) {
+    hits = misses = 0;
+    for (int i = 0; i < CACHE_COUNTER_SLOTS; i++) {
+      hits += counters_[i].hits_.load(std::memory_order_relaxed);
+      misses += counters_[i].misses_.load(std::memory_order_relaxed);
+    }
+  }
+
+ private:
+  struct alignas(64) CounterSlot {
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+  };
+
+  /* 每个线程固定用一个计数槽, 命中计数不在线程间来回传cacheline */
+  CounterSlot &Counter() {
+    static std::atomic<uint32_t> next_slot{0};
+    thread_local uint32_t slot = next_slot.fetch_add(1, std::memory_order_relaxed) % CACHE_COUNTER_SLOTS;
+    return counters_[slot];
+  }
+
+  static void Touch(ClockLine *line) {
+    if (!line->ref_.load(std::memory_order_relaxed)) line->ref_.store(1, std::memory_order_relaxed);
+  }
+
+  uint32_t Home(uint64_t addr) const {
+    return (uint32_t)(((addr / CACHELINE_SIZE) * 0x9E3779B97F4A7C15ull) >> 32) & (table_size_ - 1);
+  }
+
+  /* The line addr is mapped to, nullptr if none. Without map_lock_ this may
+     miss a line that is being moved by Erase(): the caller then goes to
+     Load(), which looks again under the lock. The caller validates key_
+     under the line lock. */
+  ClockLine *Lookup(uint64_t addr) const {
+    for (uint32_t pos = Home(addr);; pos = (pos + 1) & (table_size_ - 1)) {
+      uint32_t e = table_[pos].load(std::memory_order_acquire);
+      if (e == 0) return nullptr;
+      ClockLine *line = &lines_[e - 1];
+      if (line->key_.load(std::memory_order_relaxed) == addr) return line;
+    }
+  }
+
+  /* Under map_lock_, key_ of the line is addr. */
+  void Put(uint64_t addr, uint32_t idx) {
+    uint32_t pos = Home(addr);
+    while (table_[pos].load(std::memory_order_relaxed) != 0) pos = (pos + 1) & (table_size_ - 1);
+    table_[pos].store(idx + 1, std::memory_order_release);
+  }
+
+  /* Under map_lock_, key_ of the mapped line is still addr. 后面的表项往前挪
+     (backward shift), 不留墓碑. */
+  void Erase(uint64_t addr) {
+    uint32_t mask = table_size_ - 1;
+    uint32_t i = Home(addr);
+    for (;; i = (i + 1) & mask) {
+      uint32_t e = table_[i].load(std::memory_order_relaxed);
+      if (e == 0) return;
+      if (lines_[e - 1].key_.load(std::memory_order_relaxed) == addr) break;
+    }
+    for (uint32_t j = (i + 1) & mask;; j = (j + 1) & mask) {
+      uint32_t e = table_[j].load(std::memory_order_relaxed);
+      if (e == 0) break;
+      uint32_t home = Home(lines_[e - 1].key_.load(std::memory_order_relaxed));
+      // home 不在 (i, j] 之间, 这一项可以挪到 i
+      if (((j - home) & mask) >= ((j - i) & mask)) {
+        table_[i].store(e, std::memory_order_release);
+        i = j;
+      }
+    }
+    table_[i].store(0, std::memory_order_release);
+  }
+
+  /* CLOCK: 访问位为1的清零跳过, 锁着的(正在读写或换入换出)跳过. 返回时持有写锁. */
+  ClockLine *ClaimVictim() {
+    for (;;) {
+      ClockLine *line = &lines_[hand_.fetch_add(1, std::memory_order_relaxed) % line_num_];
+      if (line->ref_.load(std::memory_order_relaxed)) {
+        line->ref_.store(0, std::memory_order_relaxed);
+        continue;
+      }
+      if (line->lock_.try_lock_writer()) return line;
+    }
+  }
+
+  /* Miss: bring addr into a victim line. Returns the line write locked, or
+     nullptr; retry is set if addr got loaded by another thread meanwhile. */
+  ClockLine *Load(uint64_t addr, uint32_t rkey, bool &retry) {
+    ClockLine *line = ClaimVictim();
+    uint64_t old = line->key_.load(std::memory_order_relaxed);
+    if (old != 0 && line->dirty_) {
+      if (rdma_->remote_write((void *)line->value_, CACHELINE_SIZE, old, line->rkey_)) {
+        printf("remote write error\n");
+        line->lock_.unlock_writer();
+        return nullptr;
+      }
+      line->dirty_ = false;
+    }
+    map_lock_.lock();
+    if (Lookup(addr) != nullptr) {
+      // 别的线程先换入了addr, victim已经干净了, 原样留在cache里
+      map_lock_.unlock();
+      line->lock_.unlock_writer();
+      retry = true;
+      return nullptr;
+    }
+    if (old != 0) Erase(old);
+    line->key_.store(addr, std::memory_order_relaxed);
+    Put(addr, (uint32_t)(line - lines_));
+    map_lock_.unlock();
+
+    line->rkey_ = rkey;
+    if (rdma_->remote_read((void *)line->value_, CACHELINE_SIZE, addr, rkey)) {
+      printf("remote read error\n");
+      map_lock_.lock();
+      Erase(addr);
+      line->key_.store(0, std::memory_order_relaxed);
+      map_lock_.unlock();
+      line->lock_.unlock_writer();
+      return nullptr;
+    }
+    return line;
+  }
+
+  const uint32_t line_num_;
+  ConnectionManager *rdma_;
+  ClockLine *lines_;
+  std::atomic<uint32_t> *table_; // open addressing, line下标+1, 0: 空
+  uint32_t table_size_;          // 2的幂
+  Spinlock map_lock_;            // 串行化 table_ 的修改
+  alignas(64) std::atomic<uint64_t> hand_{0}; // CLOCK 指针, 单调增, 对line_num_取模
+  CounterSlot counters_[CACHE_COUNTER_SLOTS];
+};
+
+}  // namespace kv
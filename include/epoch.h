@@ -0,0 +1,238 @@
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#define EPOCH_MAX_THREADS 128
+#define EPOCH_RETIRE_BATCH 64 // 每retire这么多个对象尝试推进一次epoch
+
+namespace kv {
+
+/* Epoch based reclamation, shared by everything LocalEngine frees while
+   readers may still use it: index slots, slot bitmap entries and remote
+   value slots. Threads that may hold a reference run inside an
+   epoch_guard. A retired object is only handed to its reclaim function
+   once the global epoch moved two steps past the epoch it was retired in:
+   by then every thread that was in a critical section at retire time has
+   left it.
+
+   Retired objects are kept per thread and reclaimed by the retiring thread
+   itself, so the reclaim function runs in the thread context of some
+   retire() call (eg. may use my_thread_id).
+   A thread holds its record only while it lives: on exit its limbo bags
+   move to the manager's orphan list, which any retire() drains, and the
+   record is reused by the next new thread. More than EPOCH_MAX_THREADS
+   threads alive at once is fatal. */
+class epoch_manager {
+ public:
+  typedef void (*reclaim_fn)(void *ctx, uint64_t arg);
+
+  epoch_manager() : global_epoch_(2) { registry().add(this); }
+  ~epoch_manager() { registry().remove(this); }
+  epoch_manager(const epoch_manager &) = delete;
+  epoch_manager &operator=(const epoch_manager &) = delete;
+
+  void enter() {
+    thread_record &r = record();
+    if (r.depth++ == 0) {
+      uint64_t e = global_epoch_.load(std::memory_order_relaxed);
+      r.local_epoch.store(e, std::memory_order_relaxed);
+      // 发布local_epoch后才能读共享结构, store-load需要full fence
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+  }
+
+  void exit() {
+    thread_record &r = record();
+    assert(r.depth > 0);
+    if (--r.depth == 0) {
+      r.local_epoch.store(0, std::memory_order_release);
+    }
+  }
+
+  /* The object described by (ctx, arg) is no longer reachable from the
+     shared structure, fn(ctx, arg) frees it later. Call inside a guard. */
+  void retire(reclaim_fn fn, void *ctx, uint64_t arg) {
+    thread_record &r = record();
+    uint64_t e = global_epoch_.load(std::memory_order_acquire);
+    limbo_bag &bag = r.bags[e % 3];
+    if (bag.epoch != e) {
+      // 同一个bag上次用于 e-3 或更早的epoch, 已经可以回收
+      free_bag(bag);
+      bag.epoch = e;
+    }
+    bag.items.push_back(retired_item{fn, ctx, arg});
+    if (++r.retired % EPOCH_RETIRE_BATCH == 0) {
+      try_advance();
+      reclaim(r);
+    }
+  }
+
+ private:
+  struct retired_item {
+    reclaim_fn fn;
+    void *ctx;
+    uint64_t arg;
+  };
+
+  struct limbo_bag {
+    uint64_t epoch = 0;
+    std::vector<retired_item> items;
+  };
+
+  struct alignas(64) thread_record {
+    std::atomic<uint64_t> local_epoch{0}; // 0: 不在临界区
+    int depth = 0;
+    uint64_t retired = 0;
+    limbo_bag bags[3];
+  };
+
+  /* Record ids of the live threads, the same id in every manager. */
+  struct thread_registry {
+    std::mutex lock;
+    std::vector<epoch_manager *> managers;
+    bool used[EPOCH_MAX_THREADS] = {false};
+
+    void add(epoch_manager *m) {
+      std::lock_guard<std::mutex> guard(lock);
+      managers.push_back(m);
+    }
+
+    void remove(epoch_manager *m) {
+      std::lock_guard<std::mutex> guard(lock);
+      for (size_t i = 0; i < managers.size(); i++) {
+        if (managers[i] == m) {
+          managers[i] = managers.back();
+          managers.pop_back();
+          break;
+        }
+      }
+    }
+
+    int acquire() {
+      std::lock_guard<std::mutex> guard(lock);
+      for (int i = 0; i < EPOCH_MAX_THREADS; i++) {
+        if (!used[i]) {
+          used[i] = true;
+          return i;
+        }
+      }
+      fprintf(stderr, "epoch_manager: more than %d threads alive\n", EPOCH_MAX_THREADS);
+      abort();
+    }
+
+    void release(int tid) {
+      std::lock_guard<std::mutex> guard(lock);
+      for (epoch_manager *m : managers) m->orphan(tid);
+      used[tid] = false;
+    }
+  };
+
+  static thread_registry &registry() {
+    static thread_registry r;
+    return r;
+  }
+
+  /* Gives the record id back when the thread exits. */
+  struct thread_slot {
+    int tid = -1;
+    ~thread_slot() {
+      if (tid != -1) registry().release(tid);
+    }
+  };
+
+  thread_record &record() {
+    static thread_local thread_slot slot;
+    if (slot.tid == -1) {
+      slot.tid = registry().acquire();
+    }
+    return records_[slot.tid];
+  }
+
+  /* The thread of record tid exited (outside any critical section), its
+     pending bags are freed by whoever retires next. Under the registry lock. */
+  void orphan(int tid) {
+    thread_record &r = records_[tid];
+    assert(r.depth == 0);
+    std::lock_guard<std::mutex> guard(orphan_lock_);
+    for (auto &bag : r.bags) {
+      if (!bag.items.empty()) {
+        orphans_.push_back(limbo_bag());
+        orphans_.back().epoch = bag.epoch;
+        orphans_.back().items.swap(bag.items);
+      }
+      bag.epoch = 0;
+    }
+    r.retired = 0;
+    orphan_num_.store(orphans_.size(), std::memory_order_relaxed);
+  }
+
+  void reclaim_orphans() {
+    std::vector<limbo_bag> ready;
+    {
+      std::unique_lock<std::mutex> guard(orphan_lock_, std::try_to_lock);
+      if (!guard.owns_lock()) return;
+      uint64_t e = global_epoch_.load(std::memory_order_acquire);
+      for (size_t i = 0; i < orphans_.size();) {
+        if (orphans_[i].epoch + 2 <= e) {
+          ready.push_back(std::move(orphans_[i]));
+          orphans_[i] = std::move(orphans_.back());
+          orphans_.pop_back();
+        } else {
+          i++;
+        }
+      }
+      orphan_num_.store(orphans_.size(), std::memory_order_relaxed);
+    }
+    // 锁外执行回收函数
+    for (auto &bag : ready) free_bag(bag);
+  }
+
+  /* The epoch moves on once every thread in a critical section saw it. */
+  void try_advance() {
+    uint64_t e = global_epoch_.load(std::memory_order_acquire);
+    for (int i = 0; i < EPOCH_MAX_THREADS; i++) {
+      uint64_t l = records_[i].local_epoch.load(std::memory_order_acquire);
+      if (l != 0 && l != e) return;
+    }
+    global_epoch_.compare_exchange_strong(e, e + 1, std::memory_order_acq_rel);
+  }
+
+  void reclaim(thread_record &r) {
+    uint64_t e = global_epoch_.load(std::memory_order_acquire);
+    for (auto &bag : r.bags) {
+      if (bag.epoch + 2 <= e) free_bag(bag);
+    }
+    if (orphan_num_.load(std::memory_order_relaxed) > 0) reclaim_orphans();
+  }
+
+  void free_bag(limbo_bag &bag) {
+    for (auto &item : bag.items) item.fn(item.ctx, item.arg);
+    bag.items.clear();
+  }
+
+  std::atomic<uint64_t> global_epoch_;
+  thread_record records_[EPOCH_MAX_THREADS];
+  std::mutex orphan_lock_;
+  std::vector<limbo_bag> orphans_; // 已退出线程留下的bag
+  std::atomic<size_t> orphan_num_{0};
+};
+
+/* RAII critical section, may be nested. */
+class epoch_guard {
+ public:
+  explicit epoch_guard(epoch_manager &m) : m_(m) { m_.enter(); }
+  ~epoch_guard() { m_.exit(); }
+  epoch_guard(const epoch_guard &) = delete;
+  epoch_guard &operator=(const epoch_guard &) = delete;
+
+ private:
+  epoch_manager &m_;
+};
+
+}  // namespace kv
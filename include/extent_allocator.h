@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include "conqueue.h"
+#include "msg.h"
+#include "page_provider.h"
+#include "rdma_mem_pool.h"
+
+#define EXTENT_UNIT_SIZE 4096 // extent按4KB对齐分配
+#define EXTENT_REGION_SIZE REMOTE_CHUNK_SIZE // 每次向remote要64MB切成extent, 更大的value单独要一块
+#define MAX_EXTENT_NUM (1 << 20) // extent id 上限, 表项按需缺页
+#define MAX_LARGE_VALUE_SIZE (1u << 30) // 单次RDMA READ的长度上限以内
+#define LARGE_VALUE_SIZE ((1 << IV_SIZE_BITS) - 1) // internal_value_t::size 为此值表示value在extent中
+#define DIRECT_IO_MIN_SIZE (MAX_REMOTE_SIZE + 1) // 连接的注册buffer放不下的extent才临时注册调用者的buffer直接读写, 注册比拷贝贵
+
+static_assert(LARGE_VALUE_SIZE > MAX_SLOT_SIZE, "a slab value never has the extent size mark");
+static_assert(MAX_EXTENT_NUM <= MAX_PAGE_NUMS, "the extent id is kept in page_id");
+
+namespace kv {
+
+/* An extent: size bytes of contiguous remote memory. */
+struct extent_t {
+  uint64_t addr;
+  uint32_t rkey;
+  uint32_t size; // value size, 占用按EXTENT_UNIT_SIZE向上取整
+};
+
+/* A value stored in an extent has size LARGE_VALUE_SIZE in its
+   internal_value_t, page_id holds the extent id. */
+static inline bool is_large_value(const internal_value_t &iv) { return iv.size == LARGE_VALUE_SIZE; }
+
+static inline uint32_t extent_id_of(const internal_value_t &iv) { return iv.page_id; }
+
+static inline void set_extent_id(internal_value_t &iv, uint32_t id) {
+  iv.page_id = id;
+  iv.cache_line_id = 0;
+  iv.slot_id = 0;
+  iv.size = LARGE_VALUE_SIZE;
+}
+
+/* Allocator for values too large for the slab pages (> MAX_SLOT_SIZE).
+   Each value gets one extent: a contiguous range of remote memory, so it
+   is moved with a single RDMA READ/WRITE and never goes through the
+   cacheline cache. Extents are carved first-fit out of EXTENT_REGION_SIZE
+   regions registered through the PageProvider (same limit as the pages),
+   freed ranges are merged with their neighbours, and a region that is all
+   free is handed back to the PageProvider (one spare region is kept),
+   whose thread unregisters it off the freeing writer. Values larger than a
+   region get a region of their own.
+   Extent ids index a flat table, lookups are lock free; like slab slots an
+   id may only be freed through epoch_manager::retire (reclaim_extent). */
+class ExtentAllocator {
+ public:
+  explicit ExtentAllocator(PageProvider *provider);
+  ~ExtentAllocator();
+  ExtentAllocator(const ExtentAllocator &) = delete;
+  ExtentAllocator &operator=(const ExtentAllocator &) = delete;
+
+  /* An extent for size bytes, returns false if remote memory is exhausted. */
+  bool alloc(uint32_t size, uint32_t &id);
+  void free(uint32_t id);
+
+  const extent_t &get(uint32_t id) const { return extents_[id]; }
+
+  /* epoch_manager reclaim function, arg is the extent id. */
+  static void reclaim_extent(void *allocator, uint64_t arg) {
+    static_cast<ExtentAllocator *>(allocator)->free((uint32_t)arg);
+  }
+
+  /* Live extents and the bytes of their values, and bytes of the regions. */
+  void stats(uint64_t &extent_num, uint64_t &used_bytes, uint64_t &region_bytes);
+
+ private:
+  struct Region {
+    uint64_t addr;
+    uint64_t size;
+    uint32_t rkey;
+    uint64_t free_bytes;
+    std::map<uint64_t, uint64_t> free_ranges; // addr -> len, 不相邻
+  };
+
+  bool carve(Region *r, uint64_t len, uint64_t &addr);
+  void release_range(Region *r, uint64_t addr, uint64_t len);
+
+  PageProvider *m_page_provider_;
+  std::mutex mutex_; // 保护regions_, 大value的分配远少于小value, 不必更细
+  std::map<uint64_t, Region *> regions_; // 按起始地址
+  extent_t *extents_;
+  moodycamel::ConcurrentQueue<uint32_t> free_ids_;
+  std::atomic<uint32_t> next_id_{0};
+  std::atomic<uint64_t> extent_num_{0};
+  std::atomic<uint64_t> used_bytes_{0};
+};
+
+}  // namespace kv
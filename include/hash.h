@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#if defined(__SSE4_2__) || defined(__AES__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Key hash family. Every variant maps the 16-byte key to one 64-bit value:
+ *   high 32 bits -> shard, by multiply-shift (hash_shard)
+ *   low bits     -> bucket / group inside the shard (mask)
+ *   bits 25..31  -> 7-bit tag of simd_hash_map_t
+ * so shard, bucket and tag come from disjoint bits of one hash.
+ *
+ * Pick one with KV_HASH_CRC32C / KV_HASH_AES, otherwise hash_mix is used.
+ * A variant whose instructions are not enabled (-msse4.2 / -maes) falls
+ * back to hash_mix as well.
+ */
+#define KV_HASH_CRC32C
+// #define KV_HASH_AES
+
+namespace kv {
+
+/* The original hash: xor of the four 32-bit words, kept for comparison
+   (see new_test/hash_dist_test.cc). */
+static inline int myhash(const std::string &key) {
+  const char *str = key.c_str();
+  int a = *(int*)str;
+  str += 4;
+  a ^= *(int *)(str);
+  str += 4;
+  int b = *(int *)(str);
+  str += 4;
+  b ^= *(int *)(str);
+  a ^= b;
+  a = ((unsigned int)a) >> 2;
+  return a;
+}
+
+/* Portable multiply/xor-shift mix (murmur3 finalizer). */
+static inline uint64_t hash_mix(const char *key) {
+  uint64_t a, b;
+  memcpy(&a, key, 8);
+  memcpy(&b, key + 8, 8);
+  uint64_t h = a * 0x9E3779B97F4A7C15ULL ^ ((b << 31) | (b >> 33)) * 0xC2B2AE3D27D4EB4FULL;
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+#ifdef __SSE4_2__
+/* Two independent CRC32C lanes over the key words in opposite orders, then
+   one multiply so every output bit depends on both lanes. CRC is linear, the
+   multiply breaks the correlation between the two halves. */
+static inline uint64_t hash_crc32c(const char *key) {
+  uint64_t a, b;
+  memcpy(&a, key, 8);
+  memcpy(&b, key + 8, 8);
+  uint64_t lo = _mm_crc32_u64(_mm_crc32_u64(0x9E3779B9, a), b);
+  uint64_t hi = _mm_crc32_u64(_mm_crc32_u64(0x85EBCA6B, b), a);
+  uint64_t h = (hi << 32 | lo) * 0x9E3779B97F4A7C15ULL;
+  return h ^ (h >> 32);
+}
+#endif
+
+#if defined(__AES__) && defined(__SSE4_1__)
+/* Two AES rounds spread every key bit over the whole 128-bit state. */
+static inline uint64_t hash_aes(const char *key) {
+  __m128i x = _mm_loadu_si128((const __m128i *)key);
+  x = _mm_aesenc_si128(x, _mm_set_epi64x(0x243F6A8885A308D3ULL, 0x13198A2E03707344ULL));
+  x = _mm_aesenc_si128(x, _mm_set_epi64x(0xA4093822299F31D0ULL, 0x082EFA98EC4E6C89ULL));
+  return (uint64_t)_mm_cvtsi128_si64(x) ^ (uint64_t)_mm_extract_epi64(x, 1);
+}
+#endif
+
+static inline uint64_t kv_hash(const char *key) {
+#if defined(KV_HASH_CRC32C) && defined(__SSE4_2__)
+  return hash_crc32c(key);
+#elif defined(KV_HASH_AES) && defined(__AES__) && defined(__SSE4_1__)
+  return hash_aes(key);
+#else
+  return hash_mix(key);
+#endif
+}
+
+static inline uint64_t kv_hash(const std::string &key) { return kv_hash(key.c_str()); }
+
+/* [0, n) from the high 32 bits, no division. */
+static inline uint32_t hash_shard(uint64_t h, uint32_t n) {
+  return (uint32_t)(((h >> 32) * (uint64_t)n) >> 32);
+}
+
+#define HASH_TAG_SHIFT 25
+
+}  // namespace kv
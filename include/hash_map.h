@@ -0,0 +1,560 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <algorithm>
+#include <string>
+#include "epoch.h"
+#include "hash.h"
+#include "huge_alloc.h"
+#include "rdma_mem_pool.h"
+#include "rwlock.h"
+#include "spinlock.h"
+
+// #define USE_SIMD_HASH_MAP // 使用开放寻址+SIMD tag比较的索引代替链式hash_map_t
+// #define USE_COMPACT_SLOT // slot内value元信息压缩为48位, 需配合USE_SIMD_HASH_MAP(slot不再有next_slot_id)
+
+// #define USE_LOCKFREE_HASH_MAP // 使用CAS插入/标记删除的无锁链式索引(lockfree_hash_map_t), slot经epoch回收
+
+#if defined(USE_LOCKFREE_HASH_MAP) && defined(USE_SIMD_HASH_MAP)
+#error "USE_LOCKFREE_HASH_MAP and USE_SIMD_HASH_MAP are exclusive"
+#endif
+
+#if defined(USE_COMPACT_SLOT) && !defined(USE_SIMD_HASH_MAP)
+#error "USE_COMPACT_SLOT needs USE_SIMD_HASH_MAP, next_slot_id would pad the slot back to 28 bytes"
+#endif
+
+#define MAX_SLOT_NUMS (1 << 30) // slot id上限, slot按segment按需分配
+#define SLOT_SEGMENT_SHIFT 19 // segment按页懒分配, 可以大一些; 2^19 * 28B 正好是7个2MB大页
+#define SLOT_SEGMENT_SIZE (1 << SLOT_SEGMENT_SHIFT)
+#define MAX_SLOT_SEGMENTS (MAX_SLOT_NUMS / SLOT_SEGMENT_SIZE)
+#define SLOT_SEGMENT_PURGING (1 << 30) // 加在segment的live计数上, 表示正在把它的页还给内核
+
+#define HASH_MAP_INIT_LEVEL 10 // 初始 1024 个桶
+#define BUCKET_SEGMENT_SHIFT 12
+#define BUCKET_SEGMENT_SIZE (1 << BUCKET_SEGMENT_SHIFT)
+#define MAX_BUCKET_SEGMENTS (1 << 12) // 每个shard最多16M个桶
+#define HASH_MAP_MAX_LOAD 1.0 // 平均链长超过后split
+#define HASH_MAP_MIN_LOAD 0.5 // 平均链长低于后merge
+#define HASH_MAP_RESIZE_STEP 4 // 每次insert/remove最多迁移的桶数, 需大于1/MIN_LOAD
+#define FIND_BATCH_GROUP 16 // LocalEngine::read_batch 每组同时预取的key数
+#define SLOT_VALUE_LOCKS 1024 // 保护slot中value读写的版本锁, 按slot地址分条
+
+namespace kv {
+
+/* One slot stores the key and the meta info of the value which
+   describles the remote addr, size, remote-key on remote end.
+   Default layout: 16B key + 8B internal_value_t + 4B next_slot_id = 28B.
+   The open addressing index drops next_slot_id (24B), USE_COMPACT_SLOT
+   further packs the value into 48 bits (22B). Access the value through
+   get_value()/set_value() so both layouts work.
+   The value is updated in place while readers find the slot without
+   locks, and it is not 8B aligned (it can straddle a cache line) or is
+   stored in three parts, so a plain load could see half of an update.
+   set_value() writes under a striped seq_lock, get_value() retries until
+   it read a stable version; a reader still writes nothing. */
+#define COMPACT_PAGE_ID_BITS 20
+#define COMPACT_CACHE_LINE_BITS 4
+#define COMPACT_SLOT_ID_BITS 12
+#define COMPACT_SIZE_BITS IV_SIZE_BITS
+
+class hash_map_slot {
+ public:
+  char key[16];
+#ifdef USE_COMPACT_SLOT
+  uint16_t packed_value[3]; // page_id:20 | cache_line_id:4 | slot_id:12 | size:12
+#else
+  internal_value_t internal_value;
+#endif
+  // char finger; // key的finger，加速比较
+#ifndef USE_SIMD_HASH_MAP
+  int next_slot_id; // 由insert设置, slot内存来自huge_alloc, 不依赖构造函数
+#endif
+
+  internal_value_t get_value() const {
+    seq_lock &lock = value_lock(this);
+    internal_value_t iv;
+    uint32_t version;
+    do {
+      version = lock.read_begin();
+      iv = load_value();
+    } while (lock.read_retry(version));
+    return iv;
+  }
+
+  void set_value(const internal_value_t &iv) {
+    seq_lock &lock = value_lock(this);
+    lock.lock_writer();
+    store_value(iv);
+    lock.unlock_writer();
+  }
+
+ private:
+  struct alignas(64) value_lock_t {
+    seq_lock lock;
+  };
+
+  static seq_lock &value_lock(const hash_map_slot *slot) {
+    static value_lock_t locks[SLOT_VALUE_LOCKS];
+    return locks[((uintptr_t)slot / sizeof(hash_map_slot)) & (SLOT_VALUE_LOCKS - 1)].lock;
+  }
+
+#ifdef USE_COMPACT_SLOT
+  internal_value_t load_value() const {
+    uint64_t v = READ_ONCE(packed_value[0]) | ((uint64_t)READ_ONCE(packed_value[1]) << 16) |
+                 ((uint64_t)READ_ONCE(packed_value[2]) << 32);
+    internal_value_t iv;
+    iv.page_id = v & ((1u << COMPACT_PAGE_ID_BITS) - 1);
+    iv.cache_line_id = (v >> COMPACT_PAGE_ID_BITS) & ((1u << COMPACT_CACHE_LINE_BITS) - 1);
+    iv.slot_id = (v >> (COMPACT_PAGE_ID_BITS + COMPACT_CACHE_LINE_BITS)) & ((1u << COMPACT_SLOT_ID_BITS) - 1);
+    iv.size = v >> (COMPACT_PAGE_ID_BITS + COMPACT_CACHE_LINE_BITS + COMPACT_SLOT_ID_BITS);
+    return iv;
+  }
+
+  void store_value(const internal_value_t &iv) {
+    assert(iv.page_id < (1u << COMPACT_PAGE_ID_BITS));
+    assert(iv.cache_line_id < (1u << COMPACT_CACHE_LINE_BITS));
+    assert(iv.slot_id < (1u << COMPACT_SLOT_ID_BITS));
+    uint64_t v = (uint64_t)iv.page_id | ((uint64_t)iv.cache_line_id << COMPACT_PAGE_ID_BITS) |
+                 ((uint64_t)iv.slot_id << (COMPACT_PAGE_ID_BITS + COMPACT_CACHE_LINE_BITS)) |
+                 ((uint64_t)iv.size << (COMPACT_PAGE_ID_BITS + COMPACT_CACHE_LINE_BITS + COMPACT_SLOT_ID_BITS));
+    packed_value[0] = (uint16_t)v;
+    packed_value[1] = (uint16_t)(v >> 16);
+    packed_value[2] = (uint16_t)(v >> 32);
+  }
+#else
+  internal_value_t load_value() const { return internal_value; }
+  void store_value(const internal_value_t &iv) { internal_value = iv; }
+#endif
+};
+
+// 压缩布局能表示的上限: 每个pool的page数, 每个page的cacheline数, 每个cacheline的slot数(最小slot 16B)
+static_assert(MAX_PAGE_NUMS <= (1 << COMPACT_PAGE_ID_BITS), "page_id overflows");
+static_assert(RDMA_ALLOCATE_SIZE / CACHELINE_SIZE <= (1 << COMPACT_CACHE_LINE_BITS), "cache_line_id overflows");
+static_assert(CACHELINE_SIZE / 16 <= (1 << COMPACT_SLOT_ID_BITS), "slot_id overflows");
+static_assert(COMPACT_PAGE_ID_BITS + COMPACT_CACHE_LINE_BITS + COMPACT_SLOT_ID_BITS + COMPACT_SIZE_BITS == 48, "packed value is 48 bits");
+
+// const int hash_map_slot_size = sizeof(hash_map_slot);
+
+#define READ_PTR(addr) ((*(uint64_t*)addr) & 0x0000FFFFFFFFFFFFUL)
+
+// const int hash_map_slot_size = sizeof(hash_map_slot);
+
+/* Slot storage shared by all shards. Segments are mapped the first time a
+   slot id inside them is handed out, and their pages are only faulted in
+   when the slots are written, so memory follows the key count. Segments
+   come zero-filled from huge_alloc() and no slot constructor runs: a zero
+   slot is a valid empty one.
+   Each segment counts its live slot ids (ensure/release). When the last
+   one is released its pages go back to the kernel (MADV_DONTNEED), the
+   mapping stays, so a stale pointer still reads (zero) memory and the next
+   slot handed out there simply faults a zero page in again. */
+#define SLOT_SEGMENT_BYTES ((size_t)SLOT_SEGMENT_SIZE * sizeof(hash_map_slot))
+
+class slot_array_t {
+ public:
+  slot_array_t() {
+    for (int i = 0; i < MAX_SLOT_SEGMENTS; i++) {
+      segments_[i].store(nullptr, std::memory_order_relaxed);
+      live_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  hash_map_slot *at(int slot_id) const {
+    return &(segments_[slot_id >> SLOT_SEGMENT_SHIFT].load(std::memory_order_acquire)[slot_id & (SLOT_SEGMENT_SIZE - 1)]);
+  }
+
+  /* slot_id was handed out: make sure its segment exists and count it
+     live, call before publishing slot_id. */
+  void ensure(int slot_id) {
+    int seg = slot_id >> SLOT_SEGMENT_SHIFT;
+    assert(seg < MAX_SLOT_SEGMENTS);
+    int live = live_[seg].fetch_add(1, std::memory_order_acquire);
+    // release()正在清空这个segment的页, 等它做完再写slot
+    while (unlikely(live >= SLOT_SEGMENT_PURGING)) {
+      live = live_[seg].load(std::memory_order_acquire);
+    }
+    if (likely(segments_[seg].load(std::memory_order_acquire) != nullptr))
+      return;
+    hash_map_slot *s = (hash_map_slot *)huge_alloc(SLOT_SEGMENT_BYTES);
+    hash_map_slot *old = nullptr;
+    if (!segments_[seg].compare_exchange_strong(old, s, std::memory_order_acq_rel)) {
+      huge_free(s, SLOT_SEGMENT_BYTES); // 其他线程已经分配
+    } else {
+      segment_cnt_++;
+    }
+  }
+
+  /* slot_id is free again, no reader can reach it any more (it went back
+     through the epoch). The last live slot of a segment purges its pages. */
+  void release(int slot_id) {
+    int seg = slot_id >> SLOT_SEGMENT_SHIFT;
+    if (live_[seg].fetch_sub(1, std::memory_order_acq_rel) != 1)
+      return;
+    int zero = 0;
+    if (!live_[seg].compare_exchange_strong(zero, SLOT_SEGMENT_PURGING, std::memory_order_acq_rel))
+      return; // 又有slot被分配出去了
+    madvise(segments_[seg].load(std::memory_order_relaxed), huge_round_up(SLOT_SEGMENT_BYTES), MADV_DONTNEED);
+    purged_cnt_.fetch_add(1, std::memory_order_relaxed);
+    live_[seg].fetch_sub(SLOT_SEGMENT_PURGING, std::memory_order_release);
+  }
+
+  // 已映射的segment大小, 实际驻留内存只包含写过的页
+  uint64_t mem_use() const { return (uint64_t)segment_cnt_.load() * SLOT_SEGMENT_BYTES; }
+
+  // 因为slot全部释放而把页还给内核的次数
+  uint64_t purged_segments() const { return purged_cnt_.load(); }
+
+ private:
+  std::atomic<hash_map_slot *> segments_[MAX_SLOT_SEGMENTS];
+  std::atomic<int> live_[MAX_SLOT_SEGMENTS]; // 已分配出去的slot数, 见 release()
+  std::atomic<int> segment_cnt_{0};
+  std::atomic<uint64_t> purged_cnt_{0};
+};
+
+// 注意hash_map_t内部不会会更新位图，需要在外部管理位图
+// 伪共享问题
+struct per_slot {
+  int head_;
+  seq_lock lock_; // insert/remove bump the version, find only reads it
+  per_slot() : head_(-1) {}
+};
+
+// const int a = sizeof(per_slot);
+
+#ifndef USE_SIMD_HASH_MAP // 链式索引依赖 next_slot_id
+/* Linear hashing: the table grows one bucket split at a time (and shrinks
+   one merge at a time), piggybacked on insert/remove, so there is never a
+   stop-the-world rehash. state_ packs (level, split): buckets below split
+   already use level+1 bits. Buckets live in lazily allocated segments.
+   A merge that empties the first bucket of a segment retires the segment
+   through the epoch manager (set_epoch): readers that loaded the old
+   state may still index into it. It is freed unless a split reached it
+   again meanwhile (seg_gen_). */
+class hash_map_t {
+ public:
+  slot_array_t *global_slot_array;
+
+  hash_map_t() : global_slot_array(nullptr), state_(make_state(HASH_MAP_INIT_LEVEL, 0)), count_(0) {
+    for (int i = 0; i < MAX_BUCKET_SEGMENTS; i++) {
+      m_bucket_dir_[i].store(nullptr, std::memory_order_relaxed);
+    }
+    for (uint32_t b = 0; b < (1u << HASH_MAP_INIT_LEVEL); b += BUCKET_SEGMENT_SIZE) {
+      ensure_bucket(b);
+    }
+  }
+
+  void set_global_slot_array(slot_array_t *s) {
+    global_slot_array = s;
+  }
+
+  /* Without it, bucket segments emptied by shrinking are kept. insert and
+     remove then have to run inside an epoch_guard of m. */
+  void set_epoch(epoch_manager *m) {
+    epoch_ = m;
+  }
+
+  /* Find the corresponding key. Readers never write the bucket: the chain
+     is walked optimistically and validated against the bucket version,
+     then the bucket is re-checked against the table state in case a
+     split/merge moved the key meanwhile. */
+  hash_map_slot *find(const std::string &key) {
+    return find(key, kv_hash(key));
+  }
+
+  /* h is kv_hash(key), callers that already hashed for the shard pass it in. */
+  hash_map_slot *find(const std::string &key, uint64_t h) {
+    // char key_finger = hashcode1B(key.c_str());
+retry:
+    uint32_t index = bucket_index(h, state_.load(std::memory_order_acquire));
+    per_slot &bucket = get_bucket(index);
+    uint32_t version = bucket.lock_.read_begin();
+    int cur = READ_ONCE(bucket.head_);
+    int hops = 0;
+
+    hash_map_slot *cc = nullptr;
+    while (-1 != cur) {
+      cc = global_slot_array->at(cur);
+      if (memcmp(cc->key, (void*)key.c_str(), 16) == 0) {
+        break;
+      }
+      cur = READ_ONCE(cc->next_slot_id);
+      // 链表在遍历期间被修改(slot被复用)可能成环，定期检查版本
+      if (unlikely((++hops & 63) == 0) && bucket.lock_.read_retry(version))
+        goto retry;
+    }
+    if (bucket_index(h, state_.load(std::memory_order_acquire)) != index)
+      goto retry;
+    if (bucket.lock_.read_retry(version))
+      goto retry;
+    return (-1 == cur) ? nullptr : cc;
+  }
+
+  /* Insert into the head of the list. */
+  void insert(const std::string &key, const internal_value_t &internal_value, int new_slot_id) {
+    insert(key, kv_hash(key), internal_value, new_slot_id);
+  }
+
+  void insert(const std::string &key, uint64_t h, const internal_value_t &internal_value, int new_slot_id) {
+    hash_map_slot *new_slot = global_slot_array->at(new_slot_id);
+    memcpy(new_slot->key, key.c_str(), 16);
+    // new_slot->finger = hashcode1B(new_slot->key);
+    new_slot->set_value(internal_value);
+    per_slot &bucket = lock_bucket(h);
+    /* Insert into the head. The slot may come straight from a zero-filled
+       segment, so next_slot_id is always set. */
+    new_slot->next_slot_id = bucket.head_;
+    bucket.head_ = new_slot_id;
+    bucket.lock_.unlock_writer();
+
+    count_.fetch_add(1, std::memory_order_relaxed);
+    maybe_resize();
+  }
+
+  // if not exist or delete fail, return -1, else return kv_slot_id
+  int remove(const std::string &key) {
+    return remove(key, kv_hash(key));
+  }
+
+  int remove(const std::string &key, uint64_t h) {
+    per_slot &bucket = lock_bucket(h);
+    int cur_id = bucket.head_;
+
+    hash_map_slot *cur = nullptr;
+    int prev_id = -1;
+    while (-1 != cur_id) {
+      cur = global_slot_array->at(cur_id);
+      if (memcmp(cur->key, (void*)key.c_str(), 16) == 0) {
+        if (-1 == prev_id) {
+          bucket.head_ = cur->next_slot_id;
+        } else {
+          hash_map_slot *prev = global_slot_array->at(prev_id);
+          prev->next_slot_id = cur->next_slot_id;
+        }
+        cur->next_slot_id = -1;
+        bucket.lock_.unlock_writer();
+        count_.fetch_sub(1, std::memory_order_relaxed);
+        maybe_resize();
+        return cur_id;
+      }
+      prev_id = cur_id;
+      cur_id = cur->next_slot_id;
+    }
+    bucket.lock_.unlock_writer();
+    return -1;
+  }
+
+  /* Prefetch helpers for batched lookups. prefetch_head() reads the bucket,
+     so it should run after prefetch_bucket() had time to bring it in. */
+  void prefetch_bucket(uint64_t h) {
+    __builtin_prefetch(&get_bucket(bucket_index(h, state_.load(std::memory_order_acquire))));
+  }
+
+  void prefetch_head(uint64_t h) {
+    int head = READ_ONCE(get_bucket(bucket_index(h, state_.load(std::memory_order_acquire))).head_);
+    if (-1 != head)
+      __builtin_prefetch(global_slot_array->at(head));
+  }
+
+  /* Visit every slot. The caller keeps insert/remove (and so resize) out of
+     this map meanwhile, eg. the compactor holding the shard lock. */
+  template <typename F>
+  void for_each(F f) {
+    uint32_t n = bucket_num();
+    for (uint32_t b = 0; b < n; b++) {
+      for (int cur = get_bucket(b).head_; cur != -1; cur = global_slot_array->at(cur)->next_slot_id) {
+        f(global_slot_array->at(cur));
+      }
+    }
+  }
+
+  /* Buckets must start at -1 and are small, they stay on the heap. */
+  void prefault() {}
+
+  /* Bytes held by the bucket segments, the slots are in global_slot_array. */
+  uint64_t mem_use() const {
+    uint64_t segs = 0;
+    for (int i = 0; i < MAX_BUCKET_SEGMENTS; i++) {
+      if (m_bucket_dir_[i].load(std::memory_order_relaxed) != nullptr) segs++;
+    }
+    return sizeof(*this) + segs * BUCKET_SEGMENT_SIZE * sizeof(per_slot);
+  }
+
+  uint32_t bucket_num() const {
+    uint64_t s = state_.load(std::memory_order_relaxed);
+    return (1u << state_level(s)) + state_split(s);
+  }
+
+ private:
+  static uint64_t make_state(uint32_t level, uint32_t split) { return ((uint64_t)level << 32) | split; }
+  static uint32_t state_level(uint64_t s) { return s >> 32; }
+  static uint32_t state_split(uint64_t s) { return (uint32_t)s; }
+
+  static uint32_t bucket_index(uint64_t h, uint64_t s) {
+    uint32_t level = state_level(s);
+    uint32_t index = h & ((1ull << level) - 1);
+    if (index < state_split(s))
+      index = h & ((1ull << (level + 1)) - 1);
+    return index;
+  }
+
+  per_slot &get_bucket(uint32_t index) {
+    return m_bucket_dir_[index >> BUCKET_SEGMENT_SHIFT].load(std::memory_order_acquire)[index & (BUCKET_SEGMENT_SIZE - 1)];
+  }
+
+  void ensure_bucket(uint32_t index) {
+    uint32_t seg = index >> BUCKET_SEGMENT_SHIFT;
+    assert(seg < MAX_BUCKET_SEGMENTS);
+    // 只在构造函数和持有resize_lock_时调用，不需要CAS
+    if (m_bucket_dir_[seg].load(std::memory_order_relaxed) == nullptr) {
+      m_bucket_dir_[seg].store(new per_slot[BUCKET_SEGMENT_SIZE], std::memory_order_release);
+    }
+    // 等着释放的segment又被split用上了, 作废那次retire
+    seg_gen_[seg]++;
+  }
+
+  /* Lock the bucket that currently owns h. A split/merge that moves h must
+     hold that bucket, so once the bucket is locked and still matches the
+     table state it stays the right one until unlocked. */
+  per_slot &lock_bucket(uint64_t h) {
+    for (;;) {
+      uint32_t index = bucket_index(h, state_.load(std::memory_order_acquire));
+      per_slot &bucket = get_bucket(index);
+      bucket.lock_.lock_writer();
+      if (bucket_index(h, state_.load(std::memory_order_acquire)) == index)
+        return bucket;
+      bucket.lock_.unlock_writer();
+    }
+  }
+
+  void maybe_resize() {
+    int64_t cnt = count_.load(std::memory_order_relaxed);
+    uint32_t buckets = bucket_num();
+    bool grow = cnt > buckets * HASH_MAP_MAX_LOAD;
+    bool shrink = buckets > (1u << HASH_MAP_INIT_LEVEL) && cnt < buckets * HASH_MAP_MIN_LOAD;
+    if (likely(!grow && !shrink))
+      return;
+    // 只允许一个线程迁移，其他线程直接返回，不等待
+    if (!resize_lock_.try_lock())
+      return;
+    uint64_t unused[HASH_MAP_RESIZE_STEP];
+    int unused_num = 0;
+    for (int i = 0; i < HASH_MAP_RESIZE_STEP; i++) {
+      cnt = count_.load(std::memory_order_relaxed);
+      buckets = bucket_num();
+      if (cnt > buckets * HASH_MAP_MAX_LOAD) {
+        if (!split_one()) break;
+      } else if (buckets > (1u << HASH_MAP_INIT_LEVEL) && cnt < buckets * HASH_MAP_MIN_LOAD) {
+        uint32_t src_index = merge_one();
+        if ((src_index & (BUCKET_SEGMENT_SIZE - 1)) == 0) {
+          uint32_t seg = src_index >> BUCKET_SEGMENT_SHIFT;
+          unused[unused_num++] = ((uint64_t)seg_gen_[seg] << 32) | seg;
+        }
+      } else {
+        break;
+      }
+    }
+    resize_lock_.unlock();
+    // 回收函数要拿resize_lock_, 放锁后再retire
+    for (int i = 0; i < unused_num && epoch_ != nullptr; i++) {
+      epoch_->retire(free_bucket_segment, this, unused[i]);
+    }
+  }
+
+  /* epoch_manager reclaim function, arg is (seg_gen_, segment). */
+  static void free_bucket_segment(void *map, uint64_t arg) {
+    hash_map_t *m = static_cast<hash_map_t *>(map);
+    uint32_t seg = (uint32_t)arg, gen = arg >> 32;
+    m->resize_lock_.lock();
+    if (m->seg_gen_[seg] == gen && m->bucket_num() <= ((uint64_t)seg << BUCKET_SEGMENT_SHIFT)) {
+      per_slot *p = m->m_bucket_dir_[seg].load(std::memory_order_relaxed);
+      m->m_bucket_dir_[seg].store(nullptr, std::memory_order_relaxed);
+      delete[] p;
+    }
+    m->resize_lock_.unlock();
+  }
+
+  /* Split bucket `split` into itself and `split + 2^level`. */
+  bool split_one() {
+    uint64_t s = state_.load(std::memory_order_relaxed);
+    uint32_t level = state_level(s), split = state_split(s);
+    uint32_t src_index = split, dst_index = split + (1u << level);
+    if ((dst_index >> BUCKET_SEGMENT_SHIFT) >= MAX_BUCKET_SEGMENTS)
+      return false;
+    ensure_bucket(dst_index);
+    per_slot &src = get_bucket(src_index);
+    per_slot &dst = get_bucket(dst_index);
+    src.lock_.lock_writer();
+    dst.lock_.lock_writer();
+
+    uint64_t mask = (1ull << (level + 1)) - 1;
+    int keep = -1, move = -1;
+    int cur = src.head_;
+    while (-1 != cur) {
+      hash_map_slot *cc = global_slot_array->at(cur);
+      int next = cc->next_slot_id;
+      if ((kv_hash(cc->key) & mask) == dst_index) {
+        cc->next_slot_id = move;
+        move = cur;
+      } else {
+        cc->next_slot_id = keep;
+        keep = cur;
+      }
+      cur = next;
+    }
+    src.head_ = keep;
+    dst.head_ = move;
+
+    if (split + 1 == (1u << level)) {
+      state_.store(make_state(level + 1, 0), std::memory_order_release);
+    } else {
+      state_.store(make_state(level, split + 1), std::memory_order_release);
+    }
+    dst.lock_.unlock_writer();
+    src.lock_.unlock_writer();
+    return true;
+  }
+
+  /* Undo the last split: append bucket `split - 1 + 2^level` to `split - 1`.
+     Returns the emptied bucket, the table no longer reaches it. */
+  uint32_t merge_one() {
+    uint64_t s = state_.load(std::memory_order_relaxed);
+    uint32_t level = state_level(s), split = state_split(s);
+    if (0 == split) {
+      // (level, 0) 与 (level-1, 2^(level-1)) 等价
+      level--;
+      split = 1u << level;
+    }
+    uint32_t dst_index = split - 1, src_index = split - 1 + (1u << level);
+    per_slot &dst = get_bucket(dst_index);
+    per_slot &src = get_bucket(src_index);
+    dst.lock_.lock_writer();
+    src.lock_.lock_writer();
+
+    int cur = src.head_;
+    while (-1 != cur) {
+      hash_map_slot *cc = global_slot_array->at(cur);
+      int next = cc->next_slot_id;
+      cc->next_slot_id = dst.head_;
+      dst.head_ = cur;
+      cur = next;
+    }
+    src.head_ = -1;
+
+    state_.store(make_state(level, split - 1), std::memory_order_release);
+    src.lock_.unlock_writer();
+    dst.lock_.unlock_writer();
+    return src_index;
+  }
+
+  std::atomic<per_slot *> m_bucket_dir_[MAX_BUCKET_SEGMENTS];
+  uint32_t seg_gen_[MAX_BUCKET_SEGMENTS] = {0}; // 每次split用到这个segment加一, resize_lock_保护
+  epoch_manager *epoch_ = nullptr;
+  std::atomic<uint64_t> state_;
+  std::atomic<int64_t> count_;
+  Spinlock resize_lock_;
+};
+#endif
+
+}  // namespace kv
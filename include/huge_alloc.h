@@ -0,0 +1,58 @@
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+
+// #define USE_EXPLICIT_HUGEPAGE // MAP_HUGETLB, 需要预留大页(vm.nr_hugepages), 失败时退回THP
+
+#define HUGE_PAGE_SIZE (2ul << 20)
+#define SMALL_PAGE_SIZE (4ul << 10)
+
+namespace kv {
+
+static inline size_t huge_round_up(size_t size) {
+  return (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
+
+/* Anonymous, zero-filled, demand-paged memory for the big index arrays.
+   MAP_NORESERVE: nothing is committed until a page is touched, so a large
+   array costs neither startup time nor RSS. Backed by 2MB pages, explicit
+   ones if USE_EXPLICIT_HUGEPAGE and available, else transparent hugepages. */
+static inline void *huge_alloc(size_t size) {
+  size = huge_round_up(size);
+  void *p = MAP_FAILED;
+#if defined(USE_EXPLICIT_HUGEPAGE) && defined(MAP_HUGETLB)
+  p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_HUGETLB, -1, 0);
+#endif
+  if (p == MAP_FAILED) {
+    p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+      perror("huge_alloc mmap");
+      assert(false);
+      return nullptr;
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(p, size, MADV_HUGEPAGE);
+#endif
+  }
+  return p;
+}
+
+static inline void huge_free(void *p, size_t size) {
+  if (p) munmap(p, huge_round_up(size));
+}
+
+/* Fault the range in ahead of time, one write per small page. Callers split
+   big arrays across threads to prefault in parallel. The memory must still
+   be unused: the first byte of each page is rewritten with its own value. */
+static inline void huge_prefault(void *p, size_t size) {
+  volatile char *c = (volatile char *)p;
+  for (size_t off = 0; off < size; off += SMALL_PAGE_SIZE) {
+    c[off] = c[off];
+  }
+}
+
+}  // namespace kv
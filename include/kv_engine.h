@@ -18,22 +18,54 @@
 #include "string"
 #include "thread"
 #include <unordered_map>
+#include <mutex>
 #include "spinlock.h"
 #include "rwlock.h"
 #include "clock_cache.h"
+#include "object_cache.h"
+#include "concurrent_cache.h"
+#include "hash_map.h"
+#include "simd_hash_map.h"
+#include "lockfree_hash_map.h"
+#include "epoch.h"
+#include "slot_allocator.h"
+#include "page_provider.h"
+#include "extent_allocator.h"
 
 // #define USE_CLOCK_CACHE
+// #define USE_CONCURRENT_CACHE // 命中只置访问位, CLOCK指针无锁推进(见 concurrent_cache.h)
+// #define USE_OBJECT_CACHE // 按value缓存(见 object_cache.h), 而不是按64KB的cacheline
+// #define PREFAULT_INDEX // start()时多线程预先缺页索引内存, 否则插入时按需缺页
+// #define USE_REMOTE_COMPACTION // 后台线程把稀疏page中的value搬到其他page, 让稀疏page变空可复用
+// #define USE_REMOTE_RECLAIM // 后台线程把各shard多余的空page还给PageProvider, 整个chunk空了就还给remote
 
 #define SHARDING_NUM 173
-#define BUCKET_NUM 1048573
 
-#define REMOTE_MEM_SPACE (1 << 35ul) // 32GB
-#define PER_ALLOC_SIZE (1 << 30ul) //1G
+#define REMOTE_MEM_SPACE (1ul << 35) // 32GB, remote内存按需注册的上限
 
 #define THREAD_NUM 16
+#define COMPACTOR_THREAD_ID THREAD_NUM // 后台线程(compactor) 使用的 my_thread_id, 有自己的active page和page队列
 
-#define KV_NUMS (16 * 12000000) // 192000000
-#define SLOT_BITMAP_NUMS 192000
+#ifdef USE_CACHE_FLUSHER
+#if defined(USE_OBJECT_CACHE) || defined(USE_CONCURRENT_CACHE) || defined(USE_CLOCK_CACHE)
+#error "USE_CACHE_FLUSHER needs the LRUCache"
+#endif
+#define CACHE_FLUSH_THREADS 2 // flusher线程数, 线程i负责 index % CACHE_FLUSH_THREADS == i 的shard
+#define CACHE_FLUSH_INTERVAL_US 100 // 一轮下来没有脏line可写就休息一下
+#endif
+
+#if defined(USE_REMOTE_COMPACTION) || defined(USE_REMOTE_RECLAIM)
+#define USE_BACKGROUND_THREAD
+#define BACKGROUND_INTERVAL_MS 200 // 两轮扫描之间的间隔
+#endif
+
+#ifdef USE_REMOTE_COMPACTION
+#define COMPACT_SPARSE_RATIO 0.25 // 占用低于1/4的not-full page被搬空
+#endif
+
+#ifdef USE_REMOTE_RECLAIM
+#define RECLAIM_KEEP_EMPTY_PAGES 2 // 每个shard留着备用的空page数
+#endif
 
 #define USE_AES
 
@@ -43,30 +75,6 @@
 
 namespace kv {
 
-static inline int myhash(const std::string &key) {
-  const char *str = key.c_str();
-  int a = *(int*)str;
-  str += 4;
-  a ^= *(int *)(str);
-  str += 4;
-  int b = *(int *)(str);
-  str += 4;
-  b ^= *(int *)(str);
-  a ^= b;
-  a = ((unsigned int)a) >> 2;
-  return a;
-}
-
-extern std::queue<Page*> *page_pool_[THREAD_NUM]; // 每个线程一个池子
-
-// 用于slot分配的bitmap
-typedef struct slot_bitmap {
-  bitmap* bitmap_;
-  uint32_t bitmap_id;
-  slot_bitmap(bitmap* b, uint32_t id) : bitmap_(b), bitmap_id(id) {}
-}slot_bitmap;
-
-extern thread_local struct slot_bitmap* cur_slot_bitmap_;
 
 #ifdef USE_AES
 
@@ -90,122 +98,17 @@ typedef struct crypto_message_t {
 
 #endif
 
-/* One slot stores the key and the meta info of the value which
-   describles the remote addr, size, remote-key on remote end. */
-class hash_map_slot {
- public:
-  char key[16];
-  internal_value_t internal_value;
-  // char finger; // key的finger，加速比较
-  int next_slot_id;
-  hash_map_slot() : next_slot_id(-1) {}
-};
-
-// const int hash_map_slot_size = sizeof(hash_map_slot);
-
-#define READ_PTR(addr) ((*(uint64_t*)addr) & 0x0000FFFFFFFFFFFFUL)
-
-// const int hash_map_slot_size = sizeof(hash_map_slot);
-
-// 注意hash_map_t内部不会会更新位图，需要在外部管理位图
-// 伪共享问题
-struct per_slot {
-  int head_;
-  rw_spin_lock lock_;
-  per_slot() : head_(-1) {}
-};
-
-// const int a = sizeof(per_slot);
-
-class hash_map_t {
- public:
-  per_slot m_bucket[BUCKET_NUM];
-  // int m_bucket[BUCKET_NUM]; // 记录
-  // rw_spin_lock m_bucket_lock[BUCKET_NUM + 1]; // 每n行共用一个读写锁
-  hash_map_slot *global_slot_array;
-  // rw_spin_lock m_bucket_lock[BUCKET_NUM];
-  // char m_bucket_lock[56][BUCKET_NUM/4];
-  /* Initialize all the pointers to nullptr. */
-  hash_map_t() : global_slot_array(nullptr) {
-    // for (int i = 0; i < BUCKET_NUM; ++i) {
-    //   m_bucket[i] = -1;
-    // }
-  }
-
-  void set_global_slot_array(hash_map_slot *s) {
-    global_slot_array = s;
-  }
-
-  /* Find the corresponding key. */
-  hash_map_slot *find(const std::string &key) {
-    int index = myhash(key) % BUCKET_NUM;
-    // char key_finger = hashcode1B(key.c_str());
-    // ReadLock rl(m_bucket_lock[index]);
-    m_bucket[index].lock_.lock_reader();
-    int cur = m_bucket[index].head_;
-    
-    hash_map_slot *cc = nullptr;
-    while (-1 != cur) {
-      cc = &(global_slot_array[cur]);
-      if (memcmp(cc->key, (void*)key.c_str(), 16) == 0) {
-        m_bucket[index].lock_.unlock_reader();
-        return cc;
-      }
-      cur = cc->next_slot_id;
-    }
-    m_bucket[index].lock_.unlock_reader();
-    return nullptr;
-  }
-
-  /* Insert into the head of the list. */
-  void insert(const std::string &key, const internal_value_t &internal_value, int new_slot_id) {
-    int index = myhash(key) % BUCKET_NUM;
-    hash_map_slot *new_slot = &(global_slot_array[new_slot_id]);
-    memcpy(new_slot->key, key.c_str(), 16);
-    // new_slot->finger = hashcode1B(new_slot->key);
-    new_slot->internal_value = internal_value;
-    // WriteLock wl(m_bucket_lock[index]);
-    m_bucket[index].lock_.lock_writer();
-    int tmp_id = m_bucket[index].head_;
-    /* Insert into the head. */
-    m_bucket[index].head_ = new_slot_id;
-    if (-1 != tmp_id) {
-      new_slot->next_slot_id = tmp_id;
-    }
-    m_bucket[index].lock_.unlock_writer();
-  }
-
-  // if not exist or delete fail, return -1, else return kv_slot_id
-  int remove(const std::string &key) {
-    int index = myhash(key) % BUCKET_NUM;
-    m_bucket[index].lock_.lock_writer();
-    int cur_id = m_bucket[index].head_;
-
-    hash_map_slot *cur = nullptr;
-    int prev_id = -1;
-    while (-1 != cur_id) {
-      cur = &(global_slot_array[cur_id]);
-      if (memcmp(cur->key, (void*)key.c_str(), 16) == 0) {
-        if (-1 == prev_id) {
-          m_bucket[index].head_ = cur->next_slot_id;
-        } else {
-          hash_map_slot *prev = &(global_slot_array[prev_id]);
-          prev->next_slot_id = cur->next_slot_id;
-        }
-        cur->next_slot_id = -1;
-        m_bucket[index].lock_.unlock_writer();
-        return cur_id;
-      }
-      prev_id = cur_id;
-      cur_id = cur->next_slot_id;
-    }
-    m_bucket[index].lock_.unlock_writer();
-    return -1;
-  }
-};
-
 // const double hash_map_t_size = sizeof(hash_map_t) / 1024.0 / 1024;
 
+/* The index engine used by LocalEngine, both expose find/insert/remove. */
+#ifdef USE_SIMD_HASH_MAP
+typedef simd_hash_map_t index_map_t;
+#elif defined(USE_LOCKFREE_HASH_MAP)
+typedef lockfree_hash_map_t index_map_t;
+#else
+typedef hash_map_t index_map_t;
+#endif
+
 /* Abstract base engine */
 class Engine {
  public:
@@ -220,7 +123,7 @@ class Engine {
 /* Local-side engine */
 class LocalEngine : public Engine {
  public:
-  LocalEngine() : alloc_thread_id_(0) {};
+  LocalEngine() {};
 
   ~LocalEngine(){};
 
@@ -229,6 +132,8 @@ class LocalEngine : public Engine {
   bool alive() override;
 
   bool read(const std::string &key, std::string &value);
+  /* Multi-key read, found[i] tells whether keys[i] was read into values[i]. */
+  int read_batch(const std::string *keys, int n, std::string *values, bool *found);
 
   // phase 2 add function
 
@@ -246,27 +151,116 @@ class LocalEngine : public Engine {
 #endif
 
   void Info() {
+    uint64_t index_mem_use = 0;
+    for (int i = 0; i < SHARDING_NUM; i++) {
+      index_mem_use += m_hash_map_[i].mem_use();
+    }
+    std::cout << "Index Mem Use: slots " << ((double)m_hash_slot_array_.mem_use())/1024.0/1024.0/1024.0
+              << " GB (" << sizeof(hash_map_slot) << " B/slot), buckets "
+              << ((double)index_mem_use)/1024.0/1024.0/1024.0 << " GB" << std::endl;
 #ifdef STATIC_REMOTE_MEM_USE
     uint64_t total_remote_mem_use = 0;
     for (int i = 0; i < SHARDING_NUM; i++) {
       total_remote_mem_use += m_mem_pool_[i]->get_remote_mem_use();
     }
     std::cout << "Total Remote Mem Use: " << ((double)total_remote_mem_use)/1024.0/1024.0/1024.0 << " GB" << std::endl;
+#endif
+    uint64_t total_pages = 0, total_used = 0;
+    for (int i = 0; i < SHARDING_NUM; i++) {
+      uint32_t pages;
+      uint64_t used;
+      m_mem_pool_[i]->page_stats(pages, used);
+      total_pages += pages;
+      total_used += used;
+    }
+    std::cout << "Remote Registered: " << ((double)m_page_provider_->registered_bytes())/1024.0/1024.0/1024.0
+              << " GB" << std::endl;
+    std::cout << "Remote Pages: " << total_pages << " ("
+              << ((double)total_pages * RDMA_ALLOCATE_SIZE)/1024.0/1024.0/1024.0 << " GB), live slots "
+              << ((double)total_used)/1024.0/1024.0/1024.0 << " GB" << std::endl;
+
+    // 每个slot size的存活slot数和slot内浪费的字节(slot size - value size)
+    int64_t live[SLOT_GRANULES] = {0}, waste[SLOT_GRANULES] = {0};
+    for (int i = 0; i < SHARDING_NUM; i++) {
+      m_mem_pool_[i]->class_stats(live, waste);
+    }
+    const size_class_table *classes = m_mem_pool_[0]->size_classes();
+    std::cout << "Size classes (shard 0, version " << classes->version << "): " << classes->num << std::endl;
+    int64_t total_waste = 0;
+    for (int g = 0; g < SLOT_GRANULES; g++) {
+      if (live[g] == 0) continue;
+      total_waste += waste[g];
+      std::cout << "  slot " << g * SLOT_GRANULE << " B: " << live[g] << " live, "
+                << ((double)waste[g])/1024.0/1024.0 << " MB wasted" << std::endl;
+    }
+    std::cout << "Slot Waste: " << ((double)total_waste)/1024.0/1024.0/1024.0 << " GB" << std::endl;
+
+    uint64_t extent_num, extent_used, extent_regions;
+    m_extents_->stats(extent_num, extent_used, extent_regions);
+    std::cout << "Large Values: " << extent_num << ", " << ((double)extent_used)/1024.0/1024.0/1024.0
+              << " GB in " << ((double)extent_regions)/1024.0/1024.0/1024.0 << " GB of extent regions" << std::endl;
+
+#ifdef USE_OBJECT_CACHE
+    uint64_t hits = 0, misses = 0, objects = 0, cached_bytes = 0;
+    for (int i = 0; i < SHARDING_NUM; i++) {
+      uint64_t h, m, o, b;
+      m_cache_[i]->stats(h, m, o, b);
+      hits += h;
+      misses += m;
+      objects += o;
+      cached_bytes += b;
+    }
+    std::cout << "Object Cache: " << objects << " values in " << ((double)cached_bytes)/1024.0/1024.0/1024.0
+              << " GB, hit ratio " << (hits + misses ? (double)hits / (hits + misses) : 0.0) << std::endl;
+#else
+    uint64_t hits = 0, misses = 0;
+    for (int i = 0; i < SHARDING_NUM; i++) {
+      uint64_t h, m;
+      m_cache_[i]->stats(h, m);
+      hits += h;
+      misses += m;
+    }
+    std::cout << "Cache: " << hits << " read hits, " << misses << " misses, hit ratio "
+              << (hits + misses ? (double)hits / (hits + misses) : 0.0) << std::endl;
+#ifdef USE_CACHE_FLUSHER
+    uint64_t flushed = 0, evict_writes = 0;
+    for (int i = 0; i < SHARDING_NUM; i++) {
+      uint64_t f, e;
+      m_cache_[i]->flush_stats(f, e);
+      flushed += f;
+      evict_writes += e;
+    }
+    std::cout << "Cache Write Back: " << flushed << " lines by flushers, " << evict_writes << " on eviction" << std::endl;
+#endif
 #endif
   }
 
  private:
+  bool read_slot(int index, hash_map_slot *it, std::string &value);
+  bool write_large(const std::string &key, uint64_t h, int index, const std::string &value, bool use_aes);
+  void insert_index(int index, const std::string &key, uint64_t h, const internal_value_t &iv);
+  void retire_value(int index, const internal_value_t &iv);
+  void free_kv_slot(int kv_slot_id);
+  static void reclaim_kv_slot(void *engine, uint64_t kv_slot_id) {
+    static_cast<LocalEngine *>(engine)->free_kv_slot((int)kv_slot_id);
+  }
+
   kv::ConnectionManager *m_rdma_conn_;
+  PageProvider *m_page_provider_ = nullptr; // 按需向remote注册内存, 所有shard共用
+  ExtentAllocator *m_extents_ = nullptr; // 大于MAX_SLOT_SIZE的value, 所有shard共用
   /* NOTE: should use some concurrent data structure, and also should take the
    * extra memory overhead into consideration */
-  // TODO: 将slot array分片？
-  hash_map_slot m_hash_slot_array_[KV_NUMS];
+  slot_array_t m_hash_slot_array_; // 按segment按需分配
   // bitmap *slot_array_bitmap_[SLOT_BITMAP_NUMS]; //使用位图管理，是线程安全的嘛？
   // std::atomic<int> m_slot_cnt_{0}; /* Used to fetch the slot from hash_slot_array. */
-  hash_map_t m_hash_map_[SHARDING_NUM];         /* Hash Map with sharding. */
+  index_map_t m_hash_map_[SHARDING_NUM];        /* Hash Map with sharding. */
   RDMAMemPool *m_mem_pool_[SHARDING_NUM];
 
-#ifdef USE_CLOCK_CACHE
+#ifdef USE_OBJECT_CACHE
+  ObjectCache *m_cache_[SHARDING_NUM];
+#elif defined(USE_CONCURRENT_CACHE)
+  ConcurrentClockCache *m_cache_[SHARDING_NUM];
+#elif defined(USE_CLOCK_CACHE)
   ClockCache *m_cache_[SHARDING_NUM];
 #else
   LRUCache *m_cache_[SHARDING_NUM];
@@ -275,11 +269,32 @@ class LocalEngine : public Engine {
 #ifdef USE_AES
   crypto_message_t m_aes_;
 #endif
-  slot_bitmap* slot_map_[SLOT_BITMAP_NUMS];
-  // moodycamel::ConcurrentQueue<slot_bitmap*> slot_queue_; // 存空闲bitmap
-  std::queue<slot_bitmap *> per_thread_slot_queue_[THREAD_NUM]; // 每个线程一个slot队列
+  slot_allocator m_slot_alloc_{MAX_SLOT_NUMS}; // 分配 m_hash_slot_array_ 的slot id
+
+  /* 删除/更新释放的index slot和remote slot可能仍被并发的读者访问,
+     经过两个epoch才回收; read/write/deleteK 都在epoch_guard内执行 */
+  epoch_manager m_epoch_;
+
+#ifdef USE_CACHE_FLUSHER
+  void flush_loop(int tid);
+  std::atomic<bool> m_flush_stop_{false};
+  std::thread *m_flushers_[CACHE_FLUSH_THREADS] = {nullptr};
+#endif
+#ifdef USE_BACKGROUND_THREAD
+  void background_loop();
+  std::atomic<bool> m_background_stop_{false};
+  std::thread *m_background_ = nullptr;
+#endif
+#ifdef USE_REMOTE_COMPACTION
+  int compact_shard(int index);
 
-  std::atomic<int> alloc_thread_id_;
+  /* write/deleteK 持读锁, compactor 持写锁搬迁该shard的value,
+     读操作不加锁: 旧位置经epoch回收 */
+  MyLock m_compact_lock_[SHARDING_NUM];
+#endif
+#ifdef USE_REMOTE_RECLAIM
+  int reclaim_shard(int index);
+#endif
 };
 
 // const double a = sizeof (LocalEngine) / 1024.0 / 1024.0 / 1024.0;
@@ -314,6 +329,8 @@ class RemoteEngine : public Engine {
 
   int allocate_and_register_memory(uint64_t &addr, uint32_t &rkey, uint64_t size);
 
+  int deregister_and_free_memory(uint64_t addr);
+
   void worker(WorkerInfo *work_info, uint32_t num);
 
   struct rdma_event_channel *m_cm_channel_;
@@ -325,6 +342,15 @@ class RemoteEngine : public Engine {
   WorkerInfo **m_worker_info_;
   uint32_t m_worker_num_;
   std::thread **m_worker_threads_;
+
+  /* 分配给client的内存, 按对齐后的地址索引, unregister时释放 */
+  struct RemoteRegion {
+    void *mem; // malloc返回的地址
+    struct ibv_mr *mr;
+    uint64_t size;
+  };
+  std::unordered_map<uint64_t, RemoteRegion> m_regions_;
+  std::mutex m_region_lock_; // 多个worker并发处理请求
 };
 
 }  // namespace kv
\ No newline at end of file
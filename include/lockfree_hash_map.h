@@ -0,0 +1,195 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include "hash_map.h"
+#include "huge_alloc.h"
+
+#define LOCKFREE_BUCKET_NUM (1 << 20) // 每个shard固定桶数, 按页懒分配, 192M key 约1.1的平均链长
+
+/* Links are stored as slot_id + 1 so that 0, the value of zero-filled memory,
+   is the empty link. The top bit marks the owner node as logically deleted. */
+#define LF_NULL 0u
+#define LF_MARK 0x80000000u
+
+namespace kv {
+
+#ifndef USE_SIMD_HASH_MAP // 链式索引依赖 next_slot_id
+/* Lock-free chained index (Harris/Michael list per bucket).
+   - insert: CAS the new slot in front of the bucket head.
+   - remove: set the mark bit in the victim's next link (logical delete),
+     then CAS it out of the list (physical delete). Anyone that runs into a
+     marked node while writing helps unlinking it.
+   - find: read only, skips marked nodes, never waits.
+   Slots are identified by slot id and get reused, so every operation must
+   run inside an epoch_guard, and a removed slot id may only go back to the
+   allocator through epoch_manager::retire. The bucket count is fixed, the
+   bucket array is demand-paged like the slot array. */
+class lockfree_hash_map_t {
+ public:
+  slot_array_t *global_slot_array;
+
+  lockfree_hash_map_t() : global_slot_array(nullptr) {
+    m_bucket = (std::atomic<uint32_t> *)huge_alloc(LOCKFREE_BUCKET_BYTES);
+  }
+
+  ~lockfree_hash_map_t() { huge_free(m_bucket, LOCKFREE_BUCKET_BYTES); }
+  lockfree_hash_map_t(const lockfree_hash_map_t &) = delete;
+  lockfree_hash_map_t &operator=(const lockfree_hash_map_t &) = delete;
+
+  void set_global_slot_array(slot_array_t *s) {
+    global_slot_array = s;
+  }
+
+  void prefault() { huge_prefault(m_bucket, LOCKFREE_BUCKET_BYTES); }
+
+  hash_map_slot *find(const std::string &key) {
+    return find(key, kv_hash(key));
+  }
+
+  hash_map_slot *find(const std::string &key, uint64_t h) {
+    uint32_t cur = bucket(h).load(std::memory_order_acquire);
+    while (cur != LF_NULL) {
+      hash_map_slot *cc = slot(cur);
+      uint32_t next = next_link(cc).load(std::memory_order_acquire);
+      if (!(next & LF_MARK) && memcmp(cc->key, key.c_str(), 16) == 0)
+        return cc;
+      cur = next & ~LF_MARK;
+    }
+    return nullptr;
+  }
+
+  void insert(const std::string &key, const internal_value_t &internal_value, int new_slot_id) {
+    insert(key, kv_hash(key), internal_value, new_slot_id);
+  }
+
+  void insert(const std::string &key, uint64_t h, const internal_value_t &internal_value, int new_slot_id) {
+    hash_map_slot *new_slot = global_slot_array->at(new_slot_id);
+    memcpy(new_slot->key, key.c_str(), 16);
+    new_slot->set_value(internal_value);
+    std::atomic<uint32_t> &head = bucket(h);
+    uint32_t old = head.load(std::memory_order_relaxed);
+    do {
+      next_link(new_slot).store(old, std::memory_order_relaxed);
+    } while (!head.compare_exchange_weak(old, to_link(new_slot_id), std::memory_order_release,
+                                         std::memory_order_relaxed));
+  }
+
+  // if not exist or delete fail, return -1, else return kv_slot_id
+  int remove(const std::string &key) {
+    return remove(key, kv_hash(key));
+  }
+
+  int remove(const std::string &key, uint64_t h) {
+    for (;;) {
+      std::atomic<uint32_t> *prev;
+      uint32_t cur;
+      if (!search(h, key, prev, cur))
+        return -1;
+      hash_map_slot *cc = slot(cur);
+      uint32_t next = next_link(cc).load(std::memory_order_acquire);
+      if (next & LF_MARK)
+        continue; // 被其他线程删除了, 重新查找
+      if (!next_link(cc).compare_exchange_strong(next, next | LF_MARK, std::memory_order_acq_rel))
+        continue;
+      // 逻辑删除成功, 尝试物理删除; 失败则遍历整条链帮忙摘除,
+      // 返回前保证slot已不可达, 调用者才能retire
+      int victim = to_id(cur);
+      if (!prev->compare_exchange_strong(cur, next, std::memory_order_acq_rel))
+        unlink_marked(h);
+      return victim;
+    }
+  }
+
+  void prefetch_bucket(uint64_t h) {
+    __builtin_prefetch(&bucket(h));
+  }
+
+  void prefetch_head(uint64_t h) {
+    uint32_t head = bucket(h).load(std::memory_order_relaxed);
+    if (head != LF_NULL)
+      __builtin_prefetch(slot(head));
+  }
+
+  /* Visit every live slot, insert/remove must be kept out meanwhile. */
+  template <typename F>
+  void for_each(F f) {
+    for (uint32_t b = 0; b < LOCKFREE_BUCKET_NUM; b++) {
+      uint32_t cur = m_bucket[b].load(std::memory_order_acquire);
+      while (cur != LF_NULL) {
+        hash_map_slot *cc = slot(cur);
+        uint32_t next = next_link(cc).load(std::memory_order_acquire);
+        if (!(next & LF_MARK)) f(cc);
+        cur = next & ~LF_MARK;
+      }
+    }
+  }
+
+  uint64_t mem_use() const { return sizeof(*this) + LOCKFREE_BUCKET_BYTES; }
+
+ private:
+  static constexpr size_t LOCKFREE_BUCKET_BYTES = (size_t)LOCKFREE_BUCKET_NUM * sizeof(std::atomic<uint32_t>);
+
+  static uint32_t to_link(int slot_id) { return (uint32_t)slot_id + 1; }
+  static int to_id(uint32_t link) { return (int)((link & ~LF_MARK) - 1); }
+
+  hash_map_slot *slot(uint32_t link) const { return global_slot_array->at(to_id(link)); }
+
+  static std::atomic<uint32_t> &next_link(hash_map_slot *s) {
+    return *reinterpret_cast<std::atomic<uint32_t> *>(&s->next_slot_id);
+  }
+
+  std::atomic<uint32_t> &bucket(uint64_t h) { return m_bucket[h & (LOCKFREE_BUCKET_NUM - 1)]; }
+
+  /* Michael's search: find the first unmarked node with key, unlinking the
+     marked nodes met on the way. On return *prev is the link that pointed to
+     cur (unmarked) when it was read. */
+  bool search(uint64_t h, const std::string &key, std::atomic<uint32_t> *&prev, uint32_t &cur) {
+  retry:
+    prev = &bucket(h);
+    cur = prev->load(std::memory_order_acquire);
+    while (cur != LF_NULL) {
+      hash_map_slot *cc = slot(cur);
+      uint32_t next = next_link(cc).load(std::memory_order_acquire);
+      if (next & LF_MARK) {
+        uint32_t expected = cur;
+        if (!prev->compare_exchange_strong(expected, next & ~LF_MARK, std::memory_order_acq_rel))
+          goto retry;
+        cur = next & ~LF_MARK;
+        continue;
+      }
+      if (memcmp(cc->key, key.c_str(), 16) == 0)
+        return true;
+      prev = &next_link(cc);
+      cur = next;
+    }
+    return false;
+  }
+
+  /* Unlink every marked node of the bucket. */
+  void unlink_marked(uint64_t h) {
+  retry:
+    std::atomic<uint32_t> *prev = &bucket(h);
+    uint32_t cur = prev->load(std::memory_order_acquire);
+    while (cur != LF_NULL) {
+      uint32_t next = next_link(slot(cur)).load(std::memory_order_acquire);
+      if (next & LF_MARK) {
+        uint32_t expected = cur;
+        if (!prev->compare_exchange_strong(expected, next & ~LF_MARK, std::memory_order_acq_rel))
+          goto retry;
+        cur = next & ~LF_MARK;
+        continue;
+      }
+      prev = &next_link(slot(cur));
+      cur = next;
+    }
+  }
+
+  std::atomic<uint32_t> *m_bucket;
+};
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(int), "next_slot_id is used as an atomic link");
+#endif
+
+}  // namespace kv
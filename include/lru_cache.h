@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <mutex>
 #include <queue>
 #include <unordered_map>
@@ -5,8 +6,21 @@
 #include "rdma_conn_manager.h"
 #include "rdma_mem_pool.h"
 #include "spinlock.h"
+#include "tinylfu.h"
 
 // #define STATISTIC
+// #define USE_CACHE_BYPASS // Find miss时只读这一个value, 近期又miss的cacheline才整条读进cache
+// #define USE_CACHE_FLUSHER // 后台线程提前写回LRU尾部的脏line, miss换出的基本是干净的line
+
+#ifdef USE_CACHE_BYPASS
+#define CACHE_GHOST_NUMS (CACHELINE_NUMS * 4) // 记住最近miss过的这么多条cacheline地址
+#define CACHE_ADMIT_DISTANCE CACHELINE_NUMS // 两次miss之间隔的miss不超过这么多才接纳, 否则缓存了也等不到命中
+#endif
+
+#ifdef USE_CACHE_FLUSHER
+#define CACHE_FLUSH_DEPTH (CACHELINE_NUMS / 4) // 只看LRU尾部这么多条line
+#define CACHE_FLUSH_BATCH 4 // 每次Flush最多写回几条
+#endif
 
 #ifdef STATISTIC
 extern std::atomic<size_t> miss_times;
@@ -46,6 +60,12 @@ struct ListNode {
   /* 标记数据是否被修改，evict可以用来判读是否需要写回到remote */
   bool clean_;
   int op_times;
+#ifdef USE_TINYLFU
+  bool window_ = false; /* 在window LRU中, 否则在main LRU中 */
+#endif
+#ifdef USE_CACHE_FLUSHER
+  std::atomic<bool> flushing_{false}; /* flusher正在把buffer写到remote, 写完才能换出 */
+#endif
 };
 
 // const int ListNode_size = sizeof(ListNode);
@@ -62,8 +82,75 @@ class LRUCache {
   rw_spin_lock mutex_;
   RDMAMemPool *mem_pool; /* mem_pool 中保存了 remote addr
                             的rkey，可以调用mem_pool的接口来查询 */
+  std::atomic<uint64_t> hits_{0};   /* Find 命中次数 */
+  std::atomic<uint64_t> misses_{0}; /* Find 未命中次数 */
+#ifdef USE_CACHE_FLUSHER
+  std::atomic<uint64_t> flushed_{0};      /* flusher 写回的line数 */
+  std::atomic<uint64_t> evict_writes_{0}; /* 换出时同步写回的line数 */
 
-  inline void PushToFront(ListNode *node) {
+  /* Under the reader lock: claim the dirty lines among the
+     CACHE_FLUSH_DEPTH nodes before and including from. */
+  void CollectDirty(ListNode *from, ListNode **batch, int &n) {
+    ListNode *node = from;
+    for (int i = 0; i < CACHE_FLUSH_DEPTH && node != nullptr && n < CACHE_FLUSH_BATCH; i++, node = node->prev_) {
+      if (!node->clean_ && node->key_ != 0) {
+        node->flushing_.store(true, std::memory_order_relaxed);
+        node->clean_ = true;
+        batch[n++] = node;
+      }
+    }
+  }
+
+  /* Under the writer lock: a line among the CACHE_FLUSH_DEPTH nodes before
+     and including from that no flusher is writing, a clean one if there is,
+     nullptr if all are being written. */
+  ListNode *Unflushed(ListNode *from) {
+    ListNode *dirty = nullptr;
+    ListNode *node = from;
+    for (int i = 0; i < CACHE_FLUSH_DEPTH && node != nullptr; i++, node = node->prev_) {
+      if (node->flushing_.load(std::memory_order_acquire)) continue;
+      if (node->clean_) return node;
+      if (dirty == nullptr) dirty = node;
+    }
+    return dirty;
+  }
+#endif
+#ifdef USE_TINYLFU
+  ListNode *whead = nullptr; /* window LRU, 新读入的line先放这里 */
+  ListNode *wtail = nullptr;
+  TinyLFU filter_{CACHELINE_NUMS}; /* 按cache的line数设计 */
+#endif
+#ifdef USE_CACHE_BYPASS
+  /* 只读了value没有缓存的cacheline, 和它miss时的miss序号 */
+  struct GhostEntry {
+    std::atomic<uint64_t> addr_{0};
+    std::atomic<uint64_t> seq_{0};
+  };
+  GhostEntry ghost_[CACHE_GHOST_NUMS]; /* 按地址hash直接映射 */
+
+  /* Admission of a line that missed in Find, seq is the number of this
+     miss: the line is worth 64KB of cache only if it missed already within
+     the last CACHE_ADMIT_DISTANCE misses, ie. it would have been a hit had
+     it been cached then. Otherwise it is remembered in the ghost table with
+     seq and only the value is read. Uniform reads over many more lines than
+     the cache holds then read about just the values, lines that keep
+     missing get in on their second miss. The two fields of an entry are not
+     read as a pair; a torn read only costs one wrong guess. */
+  bool Admit(uint64_t addr, uint64_t seq) {
+    uint64_t h = (addr / CACHELINE_SIZE) * 0x9E3779B97F4A7C15ull;
+    GhostEntry &ghost = ghost_[(h >> 32) % CACHE_GHOST_NUMS];
+    if (ghost.addr_.load(std::memory_order_relaxed) == addr &&
+        seq - ghost.seq_.load(std::memory_order_relaxed) <= CACHE_ADMIT_DISTANCE) {
+      ghost.addr_.store(0, std::memory_order_relaxed);
+      return true;
+    }
+    ghost.seq_.store(seq, std::memory_order_relaxed);
+    ghost.addr_.store(addr, std::memory_order_relaxed);
+    return false;
+  }
+#endif
+
+  inline void PushToFront(ListNode *node, ListNode *&head, ListNode *&tail) {
     // push the node to the front of the double-linked list
     if (node == head) return;
 
@@ -82,6 +169,72 @@ class LRUCache {
     head = node;
   }
 
+  inline void MoveToBack(ListNode *node, ListNode *&head, ListNode *&tail) {
+    // move the node to the back of the double-linked list, evicted next
+    if (node == tail) return;
+
+    if (node == head) {
+      head = node->next_;
+      head->prev_ = nullptr;
+    } else {
+      node->prev_->next_ = node->next_;
+      node->next_->prev_ = node->prev_;
+    }
+
+    node->next_ = nullptr;
+    node->prev_ = tail;
+    tail->next_ = node;
+    tail = node;
+  }
+
+#ifdef USE_TINYLFU
+  inline void PushToFront(ListNode *node) {
+    if (node->window_)
+      PushToFront(node, whead, wtail);
+    else
+      PushToFront(node, head, tail);
+  }
+
+  inline void MoveToBack(ListNode *node) {
+    if (node->window_)
+      MoveToBack(node, whead, wtail);
+    else
+      MoveToBack(node, head, tail);
+  }
+
+  /* Move node from the list it is in to the front of the other one. */
+  inline void SwitchList(ListNode *node) {
+    ListNode *&from_head = node->window_ ? whead : head, *&from_tail = node->window_ ? wtail : tail;
+    ListNode *&to_head = node->window_ ? head : whead, *&to_tail = node->window_ ? tail : wtail;
+    if (node->prev_) node->prev_->next_ = node->next_; else from_head = node->next_;
+    if (node->next_) node->next_->prev_ = node->prev_; else from_tail = node->prev_;
+    node->prev_ = nullptr;
+    node->next_ = to_head;
+    if (to_head) to_head->prev_ = node; else to_tail = node;
+    to_head = node;
+    node->window_ = !node->window_;
+  }
+
+  /* W-TinyLFU: a missed line always goes into the window LRU. The line
+     leaving the window competes with the tail of the main LRU: the one the
+     filter saw more often stays (in main), the other is evicted. Returns
+     the node to evict, already at the front of the window. */
+  ListNode *ChooseVictim() {
+    ListNode *candidate = wtail, *victim = tail;
+    if (candidate->key_ == 0 || (victim->key_ != 0 && !filter_.admit(candidate->key_, victim->key_))) {
+      PushToFront(candidate);
+      return candidate;
+    }
+    SwitchList(candidate);
+    SwitchList(victim);
+    return victim;
+  }
+#else
+  inline void PushToFront(ListNode *node) { PushToFront(node, head, tail); }
+
+  inline void MoveToBack(ListNode *node) { MoveToBack(node, head, tail); }
+#endif
+
  public:
   LRUCache() {}
   LRUCache(uint64_t max_size, ConnectionManager *rdma_conn, RDMAMemPool *pool)
@@ -101,12 +254,45 @@ class LRUCache {
       prev_ = tmp;
     }
     tail = prev_;
+#ifdef USE_TINYLFU
+    // 末尾的几个node组成window, 其余是main
+    assert(max_size >= 2);
+    uint64_t window = std::max<uint64_t>(1, max_size * TINYLFU_WINDOW_PERCENT / 100);
+    for (uint64_t i = 0; i < window; i++) {
+      SwitchList(tail);
+    }
+#endif
   }
 
   // 返回淘汰的node
   ListNode *Evict() {
+#ifdef USE_TINYLFU
+    ListNode *node = ChooseVictim();
+#else
     auto node = tail;
+#endif
+#ifdef USE_CACHE_FLUSHER
+    // flusher正在写这条line, 不等它, 换出尾部附近别的line, 优先干净的
+    if (node->flushing_.load(std::memory_order_acquire)) {
+      ListNode *other = Unflushed(tail);
+      if (other != nullptr) {
+#ifdef USE_TINYLFU
+        // 选中的line回到main LRU尾部, 换出的line进window, 两边大小不变
+        SwitchList(node);
+        MoveToBack(node);
+        SwitchList(other);
+#endif
+        node = other;
+      }
+    }
+    // 尾部的line全在写回才等, 写完后又被改过的, 下面再写一次
+    while (node->flushing_.load(std::memory_order_acquire)) {
+    }
+#endif
     if (!node->clean_) {
+#ifdef USE_CACHE_FLUSHER
+      evict_writes_.fetch_add(1, std::memory_order_relaxed);
+#endif
       #ifdef STATISTIC
       evict_times++;
       #endif
@@ -123,6 +309,9 @@ class LRUCache {
 
   bool Insert(uint64_t addr, uint32_t rkey, uint32_t offset, uint32_t size, const char *str) {
     ListNode *node = nullptr;
+#ifdef USE_TINYLFU
+    filter_.record(addr);
+#endif
     {
       // WriteLock wl(mutex_);
       mutex_.lock_writer();
@@ -155,15 +344,37 @@ class LRUCache {
         }
         node->clean_ = false;
       }
+      // 在锁内写入, 否则放锁后这条line可能已被evict写回并换成别的line
+      memcpy(node->value_.str + offset, str, size);
       mutex_.unlock_writer();
     }
-
-    memcpy(node->value_.str + offset, str, size);
     return true;
   }
 
+  /* 丢弃addr对应的cacheline, 不写回: 它所在的remote内存要还回去了 */
+  void Invalidate(uint64_t addr) {
+    mutex_.lock_writer();
+    auto iter = hash_map.find(addr);
+    if (iter != hash_map.end()) {
+      ListNode *node = iter->second;
+      hash_map.erase(iter);
+#ifdef USE_CACHE_FLUSHER
+      // 等正在进行的写回结束, 之后remote内存才能还回去
+      while (node->flushing_.load(std::memory_order_acquire)) {
+      }
+#endif
+      node->key_ = 0;
+      node->clean_ = true;
+      MoveToBack(node);
+    }
+    mutex_.unlock_writer();
+  }
+
   bool Find(uint64_t addr, uint32_t rkey, uint32_t offset, uint32_t size, char *str) {
     ListNode *node = nullptr;
+#ifdef USE_TINYLFU
+    filter_.record(addr);
+#endif
     {
       // ReadLock rl(mutex_);
       mutex_.lock_reader();
@@ -175,29 +386,100 @@ class LRUCache {
       mutex_.unlock_reader();
     }
 
-    if (node == nullptr) {
+    if (node != nullptr) {
+      hits_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+#ifdef USE_CACHE_BYPASS
+      uint64_t miss_seq = misses_.fetch_add(1, std::memory_order_relaxed);
+#else
+      misses_.fetch_add(1, std::memory_order_relaxed);
+#endif
       #ifdef STATISTIC
       miss_times++;
       #endif
-      {
-        // WriteLock wl(mutex_);
-        mutex_.lock_writer();
-        node = Evict();
-        node->key_ = addr;
-        node->rkey_ = rkey;
-        int ret = node->remote_read(rdma);
+#ifdef USE_CACHE_BYPASS
+      if (!Admit(addr, miss_seq)) {
+        // 不在cache中的line在remote上是最新的(evict时已写回), 直接读这个value
+        int ret = rdma->remote_read(str, size, addr + offset, rkey);
         if (ret) {
           printf("remote_read error\n");
           return false;
         }
-        hash_map[addr] = node;
-        PushToFront(node);
+        return true;
+      }
+#endif
+      {
+        // WriteLock wl(mutex_);
+        mutex_.lock_writer();
+        // 放开读锁期间别的线程可能已经读入(并修改了)这条line, 不能再读一份
+        auto iter = hash_map.find(addr);
+        if (iter != hash_map.end()) {
+          node = iter->second;
+          PushToFront(node);
+        } else {
+          node = Evict();
+          node->key_ = addr;
+          node->rkey_ = rkey;
+          int ret = node->remote_read(rdma);
+          if (ret) {
+            printf("remote_read error\n");
+            return false;
+          }
+          hash_map[addr] = node;
+          PushToFront(node);
+        }
+        memcpy(str, node->value_.str + offset, size);
         mutex_.unlock_writer();
       }
-      memcpy(str, node->value_.str + offset, size);
     }
     return true;
   }
+
+  /* Find 的命中/未命中次数 */
+  void stats(uint64_t &hits, uint64_t &misses) {
+    hits = hits_.load();
+    misses = misses_.load();
+  }
+
+#ifdef USE_CACHE_FLUSHER
+  /* Write back dirty lines near the LRU tail (the next victims), so misses
+     find clean lines to evict. Only one flusher thread may call it per
+     cache. The writes are the same blocking remote_write as everywhere
+     else, there is no asynchronous I/O: the flusher thread waits for each
+     line, it only takes the write off the miss path. The lines are marked
+     clean under the reader lock, hits are not blocked, and their buffers
+     are written without any lock: an Insert during the write marks the
+     line dirty again, so it is written again before it is dropped. Evict
+     skips a line being written and takes another one near the tail, it
+     waits only if all of them are being written; Invalidate waits for the
+     write. So the buffer is not reused and writes to one addr stay in
+     order. Returns the number of lines written. */
+  int Flush() {
+    ListNode *batch[CACHE_FLUSH_BATCH];
+    int n = 0;
+    mutex_.lock_reader();
+    CollectDirty(tail, batch, n);
+#ifdef USE_TINYLFU
+    CollectDirty(wtail, batch, n);
+#endif
+    mutex_.unlock_reader();
+    for (int i = 0; i < n; i++) {
+      int ret = batch[i]->remote_write(rdma);
+      if (ret) {
+        printf("Flush write back error!\n");
+      }
+      batch[i]->flushing_.store(false, std::memory_order_release);
+    }
+    flushed_.fetch_add(n, std::memory_order_relaxed);
+    return n;
+  }
+
+  /* 写回的line数: flusher写的, 换出时同步写的 */
+  void flush_stats(uint64_t &flushed, uint64_t &evict_writes) {
+    flushed = flushed_.load();
+    evict_writes = evict_writes_.load();
+  }
+#endif
 };
 
 }  // namespace kv
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <unordered_map>
+#include "page.h"
+#include "rdma_conn_manager.h"
+#include "rwlock.h"
+#include "size_class.h"
+
+#define OBJECT_CACHE_SIZE ((uint64_t)CACHELINE_NUMS * CACHELINE_SIZE) // 每个shard的arena, 与cacheline cache占用的内存相同
+#define OBJECT_ALIGN 16 // entry 按16B对齐
+
+namespace kv {
+
+/* arena 中一个entry的头, 后面紧跟value */
+struct ObjectHeader {
+  uint64_t key_;  // value的remote地址, 0: 已失效的entry
+  uint16_t len_;  // entry总长(header + value, 对齐后), 0: 填充到arena末尾, 从头继续
+  uint16_t size_; // value size
+  uint8_t ref_;   // 上次被淘汰扫过后命中过
+  uint8_t pad_[3];
+};
+
+static_assert(sizeof(ObjectHeader) == OBJECT_ALIGN, "entries stay 16B aligned");
+
+/* Value granularity cache: caches single values, keyed by their remote
+   address (page start + cache line + slot offset), instead of whole
+   CACHELINE_SIZE lines. A miss reads just the value, one small RDMA READ,
+   and the DRAM holds only values that were asked for, not their cold
+   neighbours in the line.
+   Entries are appended to a ring arena (FIFO log), the oldest entry is
+   evicted to make room, unless it was hit since it was written: then it is
+   moved to the tail once with its ref bit cleared (FIFO with second chance,
+   approximates LRU without touching shared state on a hit but one byte).
+   Writes go through to remote right away, the cache never holds dirty data:
+   there is nothing to write back on eviction, and a slot that is freed and
+   formatted into a different size class cannot be overwritten by a stale
+   copy. Same interface as LRUCache/ClockCache, so it is a drop in for the
+   shards' cache (USE_OBJECT_CACHE). */
+class ObjectCache {
+ public:
+  ObjectCache(uint64_t capacity, ConnectionManager *rdma_conn)
+      : capacity_(ALIGN_UP(capacity, OBJECT_ALIGN)), rdma_(rdma_conn) {
+    arena_ = (char *)safe_align(capacity_, CL_SIZE, false);
+  }
+
+  ~ObjectCache() { free(arena_); }
+
+  ObjectCache(const ObjectCache &) = delete;
+  ObjectCache &operator=(const ObjectCache &) = delete;
+
+  /* 写到remote, 同时更新/加入cache */
+  bool Insert(uint64_t addr, uint32_t rkey, uint32_t offset, uint32_t size, const char *str) {
+    int ret = rdma_->remote_write((void *)str, size, addr + offset, rkey);
+    if (ret) {
+      printf("remote_write error\n");
+      return false;
+    }
+    mutex_.lock_writer();
+    write_seq_++;
+    Put(addr + offset, str, size);
+    mutex_.unlock_writer();
+    return true;
+  }
+
+  bool Find(uint64_t addr, uint32_t rkey, uint32_t offset, uint32_t size, char *str) {
+    uint64_t key = addr + offset;
+    mutex_.lock_reader();
+    auto iter = index_.find(key);
+    if (iter != index_.end()) {
+      ObjectHeader *h = At(iter->second);
+      if (h->size_ == size) {
+        memcpy(str, (char *)(h + 1), size);
+        if (!h->ref_) __atomic_store_n(&h->ref_, 1, __ATOMIC_RELAXED);
+        mutex_.unlock_reader();
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+    uint64_t seq = write_seq_;
+    mutex_.unlock_reader();
+
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    int ret = rdma_->remote_read(str, size, key, rkey);
+    if (ret) {
+      printf("remote_read error\n");
+      return false;
+    }
+    mutex_.lock_writer();
+    // 读remote期间有写入就不填充, 读到的可能是旧值
+    if (seq == write_seq_ && index_.find(key) == index_.end()) {
+      Put(key, str, size);
+    }
+    mutex_.unlock_writer();
+    return true;
+  }
+
+  /* 丢弃cacheline addr 内的所有value: 它所在的remote内存要还回去了 */
+  void Invalidate(uint64_t addr) {
+    mutex_.lock_writer();
+    for (uint64_t off = 0; off < CACHELINE_SIZE && !index_.empty(); off += SLOT_GRANULE) {
+      auto iter = index_.find(addr + off);
+      if (iter != index_.end()) {
+        At(iter->second)->key_ = 0;
+        index_.erase(iter);
+      }
+    }
+    mutex_.unlock_writer();
+  }
+
+  void stats(uint64_t &hits, uint64_t &misses, uint64_t &objects, uint64_t &bytes) {
+    hits = hits_.load();
+    misses = misses_.load();
+    mutex_.lock_reader();
+    objects = index_.size();
+    bytes = used_;
+    mutex_.unlock_reader();
+  }
+
+ private:
+  ObjectHeader *At(uint64_t off) { return (ObjectHeader *)(arena_ + off); }
+
+  static uint32_t EntryLen(uint32_t size) { return sizeof(ObjectHeader) + ALIGN_UP(size, OBJECT_ALIGN); }
+
+  /* Under the writer lock. */
+  void Put(uint64_t key, const char *str, uint32_t size) {
+    auto iter = index_.find(key);
+    if (iter != index_.end()) {
+      ObjectHeader *h = At(iter->second);
+      if (EntryLen(size) <= h->len_) {
+        memcpy((char *)(h + 1), str, size);
+        h->size_ = size;
+        return;
+      }
+      // 放不下, 原entry作废, 重新追加
+      h->key_ = 0;
+      index_.erase(iter);
+    }
+    uint32_t len = EntryLen(size);
+    MakeRoom(len);
+    ObjectHeader *h = At(tail_);
+    h->key_ = key;
+    h->len_ = len;
+    h->size_ = size;
+    h->ref_ = 0;
+    memcpy((char *)(h + 1), str, size);
+    index_[key] = tail_;
+    Advance(tail_, len);
+    used_ += len;
+  }
+
+  void Advance(uint64_t &pos, uint64_t len) {
+    pos += len;
+    if (pos == capacity_) pos = 0;
+  }
+
+  /* Make len contiguous bytes free at tail_. Used bytes are [head_, tail_)
+     around the ring, used_ tells full from empty when head_ == tail_. */
+  void MakeRoom(uint32_t len) {
+    for (;;) {
+      if (used_ == 0) {
+        head_ = tail_ = 0;
+        return;
+      }
+      if (tail_ > head_) {
+        if (capacity_ - tail_ >= len) return;
+        // 末尾放不下, 填充后从头开始
+        ObjectHeader *h = At(tail_);
+        h->key_ = 0;
+        h->len_ = 0;
+        used_ += capacity_ - tail_;
+        tail_ = 0;
+        continue;
+      }
+      if (tail_ < head_ && head_ - tail_ >= len) return;
+      EvictHead();
+    }
+  }
+
+  /* Drop the oldest entry, or move it to the tail if it was hit. The free
+     range [tail_, head_) grows by the entry first, so the move always fits;
+     every entry is moved at most once per pass, so MakeRoom ends. */
+  void EvictHead() {
+    ObjectHeader *h = At(head_);
+    if (h->len_ == 0) {
+      used_ -= capacity_ - head_;
+      head_ = 0;
+      return;
+    }
+    uint32_t len = h->len_;
+    if (h->key_ != 0 && h->ref_) {
+      char tmp[sizeof(ObjectHeader) + ALIGN_UP(MAX_SLOT_SIZE, OBJECT_ALIGN)];
+      memcpy(tmp, h, len);
+      Advance(head_, len);
+      ObjectHeader *moved = (ObjectHeader *)tmp;
+      moved->ref_ = 0;
+      memcpy(At(tail_), tmp, len);
+      index_[moved->key_] = tail_;
+      Advance(tail_, len);
+      return;
+    }
+    if (h->key_ != 0) index_.erase(h->key_);
+    used_ -= len;
+    Advance(head_, len);
+  }
+
+  char *arena_;
+  const uint64_t capacity_;
+  uint64_t head_ = 0; // 最老的entry
+  uint64_t tail_ = 0; // 下一个entry的位置
+  uint64_t used_ = 0; // [head_, tail_) 的字节数, 含作废的entry和填充
+  std::unordered_map<uint64_t, uint64_t> index_; // remote addr -> arena offset
+  rw_spin_lock mutex_;
+  ConnectionManager *rdma_;
+  uint64_t write_seq_ = 0; // Insert的次数, 写锁保护
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+};
+
+}  // namespace kv
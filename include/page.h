@@ -2,6 +2,7 @@
 
 #include "bitmap.h"
 #include "rwlock.h"
+#include "size_class.h"
 #include <assert.h>
 
 // 增加分级page
@@ -12,67 +13,82 @@
 
 namespace kv {
 
-typedef uint16_t page_id_t;
+typedef uint32_t page_id_t; // 见 internal_value_t, 实际可用位数由 MAX_PAGE_NUMS 决定
 typedef uint16_t cache_id_t;
 typedef uint16_t slot_id_t;
 
-class Page {
+#define PAGE_MAX_SLOTS (BITMAP_NUMS * (CACHELINE_SIZE / MIN_SLOT_SIZE)) // 最小的size class slot最多
+#define PAGE_BITMAP_BYTES (bitmap_bytes(PAGE_MAX_SLOTS)) // 按最坏情况内嵌在Page里
+
+/* Metadata of a 1MB remote page, one cache aligned object with the slot
+   bitmap inline (sized for the smallest size class), so formatting a page
+   for another class is a memset, nothing is malloc'd or freed as pages move
+   between classes and pools. The first cache line holds the hot fields, the
+   bitmap header (free_cnt, hint) and the summary words of the worst class;
+   the data words follow, so an alloc or free touches at most two lines.
+   kv nums is not kept apart: it is capacity - free_cnt of the bitmap. */
+class alignas(CL_SIZE) Page {
 public:
     Page(page_id_t page_id, uint64_t start_addr, uint16_t slot_size, uint32_t rkey) :
-            page_id_(page_id), start_addr_(start_addr), slot_size_(slot_size), kv_nums_(0), m_rkey_(rkey) {
-        for (int i = 0; i < BITMAP_NUMS; i++) {
-            bitmap_[i] = create_bitmap(CACHELINE_SIZE/slot_size);
-        }
+            slot_size_(slot_size), m_rkey_(rkey), start_addr_(start_addr), page_id_(page_id) {
+        init_bitmap(bitmap(), get_capacity());
     }
 
     Page(uint64_t start_addr, uint32_t rkey) : 
-        start_addr_(start_addr), kv_nums_(0), slot_size_(0), m_rkey_(rkey) {}
+        slot_size_(0), m_rkey_(rkey), start_addr_(start_addr), page_id_(0) {}
 
     ~Page() { // TODO，归还内存,不涉及Page析构，暂时不需要实现
     
     }
 
-    // 释放slot, 页空余达到1/8,返回true
+    // 释放slot, 页空余达到1/4时返回true(只有越过阈值的那一次)
     bool free_slot(cache_id_t cacheline_id, slot_id_t slot_id) {
-        put_back(bitmap_[cacheline_id], slot_id);
-        uint16_t old_kv_nums = kv_nums_.fetch_sub(1);
-        return (BITMAP_NUMS * (CACHELINE_SIZE/slot_size_)) * 3 == old_kv_nums * 4;
+        uint32_t capacity = get_capacity();
+        uint32_t free_cnt = put_back(bitmap(), cacheline_id * (CACHELINE_SIZE/slot_size_) + slot_id);
+        return capacity * 3 == (capacity - free_cnt + 1) * 4;
     }
 
-    // 获取空闲slot,失败返回false
+    // 获取空闲slot,失败返回false. 只有active page的owner线程分配, bitmap内的hint即该线程的搜索起点
      bool get_free_slot(page_id_t &page_id, cache_id_t &cacheline_id, slot_id_t &slot_id) {
-        for (int i = 0; i < BITMAP_NUMS; i++) {
-            int s = get_free(bitmap_[i]);
-            if (-1 != s) {
-                page_id = page_id_;
-                slot_id = s;
-                cacheline_id = i;
-                kv_nums_++;
-                return true;
-            }
-        }
-        return false;
+        int s = get_free(bitmap());
+        if (-1 == s)
+            return false;
+        int per_line = CACHELINE_SIZE/slot_size_; // slot不跨cacheline
+        page_id = page_id_;
+        cacheline_id = s / per_line;
+        slot_id = s % per_line;
+        return true;
     }
 
     void format_page(uint16_t slot_size) {
-        // delete旧的位图，生成新的位图
-        assert(0 == kv_nums_);
+        // 空页换size class, 重新初始化内嵌的位图
+        assert(is_empty());
         if (slot_size_ == slot_size)
             return;
         slot_size_ = slot_size;
-        for (int i = 0; i < BITMAP_NUMS; i++) {
-            delete bitmap_[i];
-            bitmap_[i] = create_bitmap(CACHELINE_SIZE/slot_size_);
-        }
+        init_bitmap(bitmap(), get_capacity());
     }
 
-    void format_newpage(uint16_t page_id, uint16_t slot_size) {
+    // 空page还给PageProvider前调用, 之后可以被任意pool当作新page使用
+    void release() {
+        assert(is_empty());
+        slot_size_ = 0;
+    }
+
+    // 复用已release的Page对象描述另一段remote内存
+    void reset(uint64_t start_addr, uint32_t rkey) {
+        assert(0 == slot_size_);
+        start_addr_ = start_addr;
+        m_rkey_ = rkey;
+        in_use_ = false;
+        queued_ = false;
+    }
+
+    void format_newpage(page_id_t page_id, uint16_t slot_size) {
         page_id_ = page_id;
-        assert(0 == kv_nums_);
+        assert(0 == slot_size_);
         slot_size_ = slot_size;
-        for (int i = 0; i < BITMAP_NUMS; i++) {
-            bitmap_[i] = create_bitmap(CACHELINE_SIZE/slot_size_);
-        }
+        init_bitmap(bitmap(), get_capacity());
     }
 
     uint32_t get_rkey() const { return m_rkey_; }
@@ -81,21 +97,46 @@ public:
 
     uint16_t get_slot_size() const { return slot_size_; }
 
-    bool is_empty() const { return 0 == kv_nums_; }
+    bool is_empty() const { return 0 == get_kv_nums(); }
+
+    page_id_t get_page_id() const { return page_id_; }
+
+    // 已分配的slot数, 未格式化的page为0
+    uint16_t get_kv_nums() const {
+        if (0 == slot_size_)
+            return 0;
+        return get_capacity() - __atomic_load_n(&bitmap()->free_cnt, __ATOMIC_RELAXED);
+    }
+
+    uint32_t get_capacity() const { return BITMAP_NUMS * (CACHELINE_SIZE/slot_size_); }
+
+    // 空余不少于1/4, 与free_slot的阈值一致
+    bool is_notfull() const {
+        return get_capacity() * 3 >= get_kv_nums() * 4u;
+    }
+
+    // 所有权标记, 由RDMAMemPool维护
+    std::atomic<bool> in_use_{false}; // 是某个线程的active page, 只有它从该页分配
+    std::atomic<bool> queued_{false}; // 在notfull_page_list_中, 防止重复入队
 private:
-    page_id_t page_id_;
-    uint64_t start_addr_; // page start addr
+    struct bitmap *bitmap() { return reinterpret_cast<struct bitmap *>(bitmap_mem_); }
+    const struct bitmap *bitmap() const { return reinterpret_cast<const struct bitmap *>(bitmap_mem_); }
+
     /**
-     * slot size:
+     * slot size, 即page所属的size class (见 size_class_table), 默认:
      *  80B - 96B
      *  97B - 112B
      * 113b - 128B
      *    ...
+     * 0: 未格式化
      */
     uint16_t slot_size_;
-    std::atomic<uint16_t> kv_nums_; // record kv nums in this page 
     uint32_t m_rkey_; // page remote memory rkey
-    bitmap *bitmap_[BITMAP_NUMS]; // use bitmap for alloc and gc, per CACHE_ENTRY need a bitmap
+    uint64_t start_addr_; // page start addr
+    page_id_t page_id_;
+    // use bitmap for alloc and gc, 第 i 个cacheline的slot j 对应 bit i*(CACHELINE_SIZE/slot_size_)+j
+    // 前面的字段共24B, 最小size class时 header+summary 正好填满第一个cacheline
+    alignas(8) unsigned char bitmap_mem_[PAGE_BITMAP_BYTES];
 };
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "conqueue.h"
+#include "page.h"
+#include "rdma_conn_manager.h"
+#include "rdma_mem_pool.h"
+
+#define REMOTE_CHUNK_SIZE (64ul << 20) // 每次向remote注册64MB, 切成page
+#define PAGE_POOL_LOW_WATERMARK 16 // 线程剩余page少于这么多时, 后台再要一个chunk
+#define PAGE_STEAL_MAX 32 // 一次最多从别的线程偷这么多page
+
+namespace kv {
+
+/* Hands out the 1MB remote pages every RDMAMemPool formats into slabs.
+   Remote memory is registered lazily, chunk by chunk, by a background
+   thread: each thread (my_thread_id) has its own queue of pages, when it
+   runs below PAGE_POOL_LOW_WATERMARK the thread asks for another chunk and
+   goes on, the chunk normally arrives before the queue is empty. Only a
+   thread that did run dry (eg. its first page) waits for the registration.
+   A thread that runs dry first steals half the queue of the thread holding
+   the most pages, and the provisioner hands out returned pages, then the
+   surplus of the richest thread, before it registers anything: a skewed
+   write phase keeps going on the idle threads' pages. The queues are MPMC,
+   so threads sharing a my_thread_id are safe too.
+   So start() costs no RPC and the remote footprint grows with the data, up
+   to total_limit.
+   Pools hand their surplus empty pages back with put_page. They are handed
+   out again before new chunks are registered, fullest chunk first, and a
+   chunk whose pages all came back is unregistered, so the remote node gets
+   the memory back when the data shrinks. trim() also takes back the pages
+   the thread queues hold above PAGE_POOL_LOW_WATERMARK, which would keep
+   their chunks alive; the watermark stays so writers do not stall. */
+class PageProvider {
+ public:
+  PageProvider(ConnectionManager *conn_manager, uint64_t total_limit)
+      : m_rdma_conn_(conn_manager), total_limit_(total_limit) {
+    for (int i = 0; i < POOL_THREAD_NUM; i++) wanted_[i] = false;
+  }
+  ~PageProvider() { stop(); }
+  PageProvider(const PageProvider &) = delete;
+  PageProvider &operator=(const PageProvider &) = delete;
+
+  /* Start the provisioning thread. */
+  void start();
+  void stop();
+
+  /* A fresh page for thread tid, nullptr if remote memory is exhausted. */
+  Page *get_page(int tid);
+  /* Give back an empty page, its bitmap already released (Page::release). */
+  void put_page(Page *page);
+  /* Take back the queued pages above the watermark and unregister every
+     chunk that is all back. */
+  void trim();
+
+  /* Register size bytes of remote memory for the caller's own use (eg. the
+     extent allocator), counted against the same limit as the pages. */
+  bool get_region(uint64_t size, uint64_t &addr, uint32_t &rkey);
+  /* Give a region back. Only queued: the provisioning thread unregisters
+     it, the caller (eg. an epoch reclaim on a writer) does no RPC. */
+  void put_region(uint64_t addr, uint64_t size);
+
+  uint64_t registered_bytes() const { return registered_bytes_.load(); }
+
+ private:
+  void request(int tid);
+  bool any_wanted() const;
+  void provision_loop();
+  void unregister_regions();
+  bool provision(int tid);
+  size_t reuse_pages(Page **pages, size_t n);
+  size_t steal_pages(int tid, Page **pages, size_t n, size_t min_left);
+  Page *new_page(uint64_t start_addr, uint32_t rkey);
+
+  /* 一次注册的remote内存 */
+  struct RemoteChunk {
+    uint64_t addr;
+    std::vector<Page *> returned; // 还回来的page, 全部还回来就unregister
+  };
+
+  ConnectionManager *m_rdma_conn_;
+  const uint64_t total_limit_;
+  moodycamel::ConcurrentQueue<Page *> pages_[POOL_THREAD_NUM];
+  std::atomic<bool> wanted_[POOL_THREAD_NUM]; // 该线程要一个新chunk
+  moodycamel::ConcurrentQueue<std::pair<uint64_t, uint64_t>> unused_regions_; // put_region 还回来的 (addr, size)
+  std::atomic<uint64_t> registered_bytes_{0};
+  std::atomic<bool> exhausted_{false}; // remote 注册失败或到达上限
+  std::atomic<bool> stop_{false};
+  std::map<uint64_t, RemoteChunk *> chunks_; // 按地址, mutex_保护
+  std::atomic<uint32_t> returned_num_{0}; // chunks_中还回来的page数
+  std::vector<Page *> spare_pages_; // unregister后留下的Page对象, pool的统计可能还在读, 不delete
+  std::mutex mutex_;
+  std::condition_variable cv_; // 唤醒 provisioner
+  std::condition_variable ready_cv_; // 唤醒等page的线程
+  std::thread *thread_ = nullptr;
+};
+
+}  // namespace kv
@@ -22,10 +22,15 @@ class RDMAConnection {
  public:
   int init(const std::string ip, const std::string port);
   int register_remote_memory(uint64_t &addr, uint32_t &rkey, uint64_t size);
+  int unregister_remote_memory(uint64_t addr);
   int remote_read(void *ptr, uint64_t size, uint64_t remote_addr,
                   uint32_t rkey);
   int remote_write(void *ptr, uint64_t size, uint64_t remote_addr,
                    uint32_t rkey);
+  int remote_read_direct(void *ptr, uint64_t size, uint64_t remote_addr,
+                         uint32_t rkey);
+  int remote_write_direct(const void *ptr, uint64_t size, uint64_t remote_addr,
+                          uint32_t rkey);
 
  public:
   struct ibv_mr *rdma_register_memory(void *ptr, uint64_t size);
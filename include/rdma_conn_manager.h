@@ -41,10 +41,17 @@ class ConnectionManager {
   int init(const std::string ip, const std::string port, uint32_t rpc_conn_num,
            uint32_t one_sided_conn_num);
   int register_remote_memory(uint64_t &addr, uint32_t &rkey, uint64_t size);
+  int unregister_remote_memory(uint64_t addr);
   int remote_read(void *ptr, uint32_t size, uint64_t remote_addr,
                   uint32_t rkey);
   int remote_write(void *ptr, uint32_t size, uint64_t remote_addr,
                    uint32_t rkey);
+  /* Read/write a buffer of any size (up to the link's message size) with one
+     RDMA operation, the buffer is registered per call: for large buffers */
+  int remote_read_direct(void *ptr, uint32_t size, uint64_t remote_addr,
+                         uint32_t rkey);
+  int remote_write_direct(const void *ptr, uint32_t size, uint64_t remote_addr,
+                          uint32_t rkey);
 
  private:
   ConnQue *m_rpc_conn_queue_;
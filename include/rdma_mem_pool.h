@@ -1,38 +1,74 @@
 #pragma once
 
+#include <string.h>
+#include <vector>
 #include "page.h"
 #include "rwlock.h"
 #include "rdma_conn_manager.h"
 #include "conqueue.h"
+#include "size_class.h"
 
 // #define STATIC_REMOTE_MEM_USE
-#define PAGE_LEVELS 64
+#define POOL_THREAD_NUM 17 // THREAD_NUM个工作线程 + 1个compactor
 
 namespace kv {
 
-typedef struct internal_value_t {
-  page_id_t page_id; // 每个pool内部的page_id不会重复,16位足够
-	cache_id_t cache_line_id; // cacheline_id, 2M / 16K = 128, 够用
-  slot_id_t slot_id; // cacheline内slot_id, 16K / 80B = 204
-  uint16_t size; // value size
+/* Packed 64-bit remote pointer: the page (an index into the pool's page
+   table, the Page knows region address, rkey and slot size), the slot in
+   the page and the value size. Values in extents use page_id as extent id
+   (see extent_allocator.h). Aligned to 2 like the uint16_t fields it
+   replaced, so index slots keep their size. */
+#define IV_PAGE_ID_BITS 32
+#define IV_CACHE_LINE_BITS 8
+#define IV_SLOT_ID_BITS 12
+#define IV_SIZE_BITS 12
+
+typedef struct __attribute__((packed, aligned(2))) internal_value_t {
+  uint64_t page_id : IV_PAGE_ID_BITS; // 每个pool内部的page_id不会重复
+  uint64_t cache_line_id : IV_CACHE_LINE_BITS; // page内cacheline_id, 1M / 64K = 16
+  uint64_t slot_id : IV_SLOT_ID_BITS; // cacheline内slot_id, 64K / 96B = 682
+  uint64_t size : IV_SIZE_BITS; // value size
   internal_value_t() : page_id(0), cache_line_id(0), slot_id(0), size(0) {}
 } internal_value_t;
 
+static_assert(sizeof(internal_value_t) == sizeof(uint64_t), "internal_value_t is retired as one uint64_t");
+static_assert(IV_PAGE_ID_BITS + IV_CACHE_LINE_BITS + IV_SLOT_ID_BITS + IV_SIZE_BITS == 64, "packed into 64 bits");
+static_assert(RDMA_ALLOCATE_SIZE / CACHELINE_SIZE <= (1 << IV_CACHE_LINE_BITS), "cache_line_id overflows");
+static_assert(CACHELINE_SIZE / MIN_SLOT_SIZE <= (1 << IV_SLOT_ID_BITS), "slot_id overflows");
+static_assert(MAX_SLOT_SIZE < (1 << IV_SIZE_BITS), "size overflows");
+
 // const int internal_value_t_size = sizeof(internal_value_t);
 
-#define MAX_PAGE_NUMS 512 // 每个pool256个page应该足够用
+/* Two level page table: page_id -> Page, PAGE_TABLE_LEAF_SIZE entries per
+   leaf, leaves allocated when the first id in them is handed out. */
+#define PAGE_TABLE_LEAF_BITS 10
+#define PAGE_TABLE_LEAF_SIZE (1u << PAGE_TABLE_LEAF_BITS)
+#define PAGE_TABLE_DIR_SIZE 1024
+#define MAX_PAGE_NUMS (PAGE_TABLE_DIR_SIZE * PAGE_TABLE_LEAF_SIZE) // 每个pool 1M个page, 1MB的page即1TB remote内存
+
+static_assert((uint64_t)MAX_PAGE_NUMS <= (1ull << IV_PAGE_ID_BITS), "page_id overflows");
+
+class PageProvider;
 
 class RDMAMemPool {
  public:
-  RDMAMemPool(ConnectionManager *conn_manager): m_rdma_conn_(conn_manager), alloc_page_id_(0) 
+  RDMAMemPool(ConnectionManager *conn_manager, PageProvider *page_provider)
+      : m_rdma_conn_(conn_manager), m_page_provider_(page_provider), alloc_page_id_(0) 
 #ifdef STATIC_REMOTE_MEM_USE
          , remote_mem_use(0) 
 #endif
   {
-    for (int i = 0; i < PAGE_LEVELS; i++) {
-      is_using_page_list_[i] = nullptr;
+    for (int t = 0; t < POOL_THREAD_NUM; t++) {
+      for (int i = 0; i < PAGE_LEVELS; i++) {
+        active_page_[t][i] = nullptr;
+      }
     }
-    page_map_ = (Page**)malloc(sizeof(Page*) * MAX_PAGE_NUMS);
+    for (int i = 0; i < PAGE_TABLE_DIR_SIZE; i++) {
+      page_dir_[i].store(nullptr, std::memory_order_relaxed);
+    }
+    size_class_table *t = size_class_table::uniform();
+    tables_.push_back(t);
+    classes_.store(t);
   }
 
   ~RDMAMemPool() { destory(); }
@@ -41,26 +77,95 @@ class RDMAMemPool {
 
   bool free_slot_in_page(const internal_value_t &iv);
 
+  /* epoch_manager reclaim function, arg is the internal_value_t of the slot. */
+  static void reclaim_remote_slot(void *pool, uint64_t arg) {
+    internal_value_t iv;
+    memcpy((void *)&iv, &arg, sizeof(iv));
+    static_cast<RDMAMemPool *>(pool)->free_slot_in_page(iv);
+  }
+
+  static uint64_t to_reclaim_arg(const internal_value_t &iv) {
+    uint64_t arg = 0;
+    memcpy(&arg, (const void *)&iv, sizeof(arg));
+    return arg;
+  }
+
   bool get_page_info(page_id_t page_id, uint64_t &start_addr, uint32_t &rkey, uint16_t &slot_size);
 
+  /* Page ids handed out so far are below this. */
+  page_id_t page_id_end() const { return alloc_page_id_.load(); }
+
 #ifdef STATIC_REMOTE_MEM_USE
   uint64_t get_remote_mem_use() { return remote_mem_use.load(); }
 #endif
 
+  /* Compaction: take the not-full pages whose occupancy is below ratio out
+     of circulation (marked in_use_, so neither refill nor free touches
+     them) and append them to victims. Empty pages go to empty_page_list. */
+  void collect_sparse_pages(double ratio, std::vector<Page *> &victims);
+  /* Hand evacuated pages back, they are reused through notfull_page_list_. */
+  void return_pages(const std::vector<Page *> &pages);
+  /* Take the empty pages beyond keep out of the pool, their page ids are
+     reused, and append them to pages, bitmaps released. The caller must
+     drop their cache lines and give them to PageProvider::put_page. */
+  void trim_empty_pages(size_t keep, std::vector<Page *> &pages);
+  /* Pages allocated by this pool, and bytes of the slots in use in them. */
+  void page_stats(uint32_t &page_num, uint64_t &used_bytes);
+
+  /* An update shrank a value in place, slot slack grows by old - new. */
+  void note_resize(uint16_t slot_size, uint16_t old_size, uint16_t new_size);
+  /* Add the live slots and the bytes wasted inside them, per slot size
+     granule (arrays of SLOT_GRANULES). */
+  void class_stats(int64_t *live, int64_t *waste);
+  const size_class_table *size_classes() const { return classes_.load(std::memory_order_acquire); }
+
  private:
   void destory();
+  void release_page(Page *page);
+  void release_stale_pages(int tid, const size_class_table *classes);
+  Page *refill_page(uint16_t slot_size);
+  bool reclaim_retired_pages();
+  Page *page_at(page_id_t page_id) const {
+    Page **leaf = page_dir_[page_id >> PAGE_TABLE_LEAF_BITS].load(std::memory_order_acquire);
+    return leaf ? leaf[page_id & (PAGE_TABLE_LEAF_SIZE - 1)] : nullptr;
+  }
+  void set_page(page_id_t page_id, Page *page);
+  void sample_size(int tid, uint32_t size);
+  void rebuild_size_classes();
 
   ConnectionManager *m_rdma_conn_;     /* rdma connection manager */
+  PageProvider *m_page_provider_;      /* 新page的来源 */
  
   std::atomic<page_id_t> alloc_page_id_; // 分配page_id
-  std::atomic<Page *> is_using_page_list_[PAGE_LEVELS]; /* is using page list */ // page每16B分一级， 
-  moodycamel::ConcurrentQueue<Page *> notfull_page_list_[PAGE_LEVELS]; // page 16B 分级放入不同的queue后续使用
+  moodycamel::ConcurrentQueue<page_id_t> free_page_ids_; // trim掉的page的id, 先于alloc_page_id_使用
+  // 每个线程每个size class一个active page, 只有owner线程读写
+  Page *active_page_[POOL_THREAD_NUM][PAGE_LEVELS];
+  // 按page的slot size(16B一级)放入不同的queue; 不再是当前size class的slot size
+  // 对应的queue只回收其中变空的page
+  moodycamel::ConcurrentQueue<Page *> notfull_page_list_[SLOT_GRANULES];
   moodycamel::ConcurrentQueue<Page *> empty_page_list; // 空page
 
-  Page **page_map_; // 目前设置大小为256，应该足够 读写不需要加锁(alloc_page_id_顺序加锁分配到)
+  // page table, 读不加锁; 叶子首次用到时CAS装入, 析构时释放
+  std::atomic<Page **> page_dir_[PAGE_TABLE_DIR_SIZE];
 #ifdef STATIC_REMOTE_MEM_USE
   std::atomic<uint64_t> remote_mem_use; // 单位为B
 #endif
-  rw_spin_lock page_info_lock_;
+
+  std::atomic<size_class_table *> classes_; // 当前的size class划分
+  std::vector<size_class_table *> tables_; // 用过的所有划分, 析构时释放; 很少变化, 不回收
+#ifdef USE_ADAPTIVE_SIZE_CLASS
+  std::atomic<uint64_t> size_hist_[SLOT_GRANULES] = {}; // 采样的value size分布
+  std::atomic<uint32_t> samples_{0};
+  std::atomic<bool> rebuilding_{false};
+#endif
+
+  // 每个线程自己的计数, 只有owner线程写, 统计时不加锁读
+  struct alignas(64) thread_stat {
+    uint32_t tick = 0;
+    uint32_t version = 0; // active_page_ 对应的size class版本
+    int64_t live[SLOT_GRANULES] = {};
+    int64_t waste[SLOT_GRANULES] = {}; // slot size - value size 之和
+  };
+  thread_stat stats_[POOL_THREAD_NUM];
 };
 }  // namespace kv
\ No newline at end of file
@@ -58,6 +58,52 @@ public:
     }
 };
 
+// 版本锁(seqlock): 写者把版本号改为奇数后修改，结束时再加1；
+// 读者不写共享内存，读前读后比较版本号，不一致则重试
+class seq_lock {
+	std::atomic<uint32_t> version_{0};
+
+public:
+	seq_lock() = default;
+	seq_lock(const seq_lock&) = delete;
+	seq_lock &operator=(const seq_lock&) = delete;
+
+	uint32_t read_begin() const {
+        uint32_t v;
+        while ((v = version_.load(std::memory_order_acquire)) & 1) {
+            pause_cpu();
+        }
+        return v;
+    }
+
+	// true if a writer ran since read_begin(), the read must be retried
+	bool read_retry(uint32_t v) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return version_.load(std::memory_order_relaxed) != v;
+    }
+
+	void lock_writer() {
+        while (true) {
+            uint32_t v = version_.load(std::memory_order_relaxed);
+            if (!(v & 1) && version_.compare_exchange_weak(v, v + 1, std::memory_order_acquire))
+                break;
+            pause_cpu();
+        }
+    }
+
+	// 不等待, 没有写者时才拿到
+	bool try_lock_writer() {
+        uint32_t v = version_.load(std::memory_order_relaxed);
+        return !(v & 1) && version_.compare_exchange_strong(v, v + 1, std::memory_order_acquire);
+    }
+
+	void unlock_writer() {
+        version_.fetch_add(1, std::memory_order_release);
+    }
+};
+
+#define READ_ONCE(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+
 typedef std::shared_mutex MyLock;
 typedef std::unique_lock<MyLock> WriteLock;
 typedef std::shared_lock<MyLock> ReadLock;
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "hash_map.h"
+#include "huge_alloc.h"
+#include "rwlock.h"
+
+#define SIMD_GROUP_SLOTS 12
+#define SIMD_GROUP_NUM (1 << 17) // 每个shard 131072 个group，约1.5M个slot
+#define SIMD_GROUP_BYTES ((size_t)SIMD_GROUP_NUM * sizeof(simd_group))
+
+#define SIMD_CTRL_EMPTY 0x00
+#define SIMD_CTRL_DELETED 0x01
+#define SIMD_CTRL_FULL 0x80 // full slot: 0x80 | 7bit tag
+
+namespace kv {
+
+/* The group comes from the low bits of kv_hash and the shard from the high
+   32 bits, the tag takes the 7 bits right below the shard bits. */
+static inline uint8_t simd_tag(uint64_t h) { return SIMD_CTRL_FULL | (uint8_t)((h >> HASH_TAG_SHIFT) & 0x7f); }
+
+/* One group is exactly one cache line: 12 ctrl bytes + version + 12 slot ids.
+   The 16-byte ctrl load also covers lock_, those bytes are masked out. */
+struct alignas(64) simd_group {
+  uint8_t ctrl_[SIMD_GROUP_SLOTS];
+  seq_lock lock_; // writers bump the version, readers validate against it
+  int slot_id_[SIMD_GROUP_SLOTS];
+
+  simd_group() { memset(ctrl_, SIMD_CTRL_EMPTY, sizeof(ctrl_)); }
+
+  /* bit i set if ctrl_[i] == c */
+  uint32_t match(uint8_t c) const {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_load_si128((const __m128i *)ctrl_);
+    uint32_t m = _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)c)));
+    return m & ((1u << SIMD_GROUP_SLOTS) - 1);
+#else
+    uint32_t m = 0;
+    for (int i = 0; i < SIMD_GROUP_SLOTS; i++) {
+      if (ctrl_[i] == c) m |= 1u << i;
+    }
+    return m;
+#endif
+  }
+
+  /* bit i set if ctrl_[i] is empty or deleted, ie. not full */
+  uint32_t match_free() const {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_load_si128((const __m128i *)ctrl_);
+    uint32_t m = ~_mm_movemask_epi8(ctrl); // full slot has the sign bit
+    return m & ((1u << SIMD_GROUP_SLOTS) - 1);
+#else
+    uint32_t m = 0;
+    for (int i = 0; i < SIMD_GROUP_SLOTS; i++) {
+      if (!(ctrl_[i] & SIMD_CTRL_FULL)) m |= 1u << i;
+    }
+    return m;
+#endif
+  }
+};
+
+static_assert(sizeof(simd_group) == 64, "simd_group should be one cache line");
+
+/* Open addressing index: a key probes groups (triangular probing) from its
+   home group, and stops at the first group that still has an empty slot.
+   Slots are the same hash_map_slot as the chained map, so a lookup touches
+   the group's cache line plus the matched slot. */
+class simd_hash_map_t {
+ public:
+  simd_group *m_group; // SIMD_GROUP_NUM 个group, 全0即全部EMPTY, 按页懒分配
+  slot_array_t *global_slot_array;
+
+  simd_hash_map_t() : global_slot_array(nullptr) {
+    static_assert(SIMD_CTRL_EMPTY == 0, "zero-filled groups must be empty");
+    m_group = (simd_group *)huge_alloc(SIMD_GROUP_BYTES);
+  }
+
+  ~simd_hash_map_t() { huge_free(m_group, SIMD_GROUP_BYTES); }
+  simd_hash_map_t(const simd_hash_map_t &) = delete;
+  simd_hash_map_t &operator=(const simd_hash_map_t &) = delete;
+
+  /* Fault in all groups now instead of on first insert. */
+  void prefault() { huge_prefault(m_group, SIMD_GROUP_BYTES); }
+
+  void set_global_slot_array(slot_array_t *s) {
+    global_slot_array = s;
+  }
+
+  hash_map_slot *find(const std::string &key) {
+    return find(key, kv_hash(key));
+  }
+
+  hash_map_slot *find(const std::string &key, uint64_t h) {
+    uint8_t tag = simd_tag(h);
+    uint32_t g = h & (SIMD_GROUP_NUM - 1);
+    for (uint32_t i = 1; i <= SIMD_GROUP_NUM; i++) {
+      simd_group &grp = m_group[g];
+      hash_map_slot *found;
+      bool stop;
+      uint32_t version;
+      do {
+        version = grp.lock_.read_begin();
+        found = nullptr;
+        uint32_t m = grp.match(tag);
+        while (m) {
+          hash_map_slot *cc = global_slot_array->at(READ_ONCE(grp.slot_id_[__builtin_ctz(m)]));
+          if (memcmp(cc->key, key.c_str(), 16) == 0) {
+            found = cc;
+            break;
+          }
+          m &= m - 1;
+        }
+        stop = grp.match(SIMD_CTRL_EMPTY) != 0;
+      } while (grp.lock_.read_retry(version));
+      if (found) return found;
+      if (stop) break;
+      g = (g + i) & (SIMD_GROUP_NUM - 1);
+    }
+    return nullptr;
+  }
+
+  void insert(const std::string &key, const internal_value_t &internal_value, int new_slot_id) {
+    insert(key, kv_hash(key), internal_value, new_slot_id);
+  }
+
+  void insert(const std::string &key, uint64_t h, const internal_value_t &internal_value, int new_slot_id) {
+    uint8_t tag = simd_tag(h);
+    hash_map_slot *new_slot = global_slot_array->at(new_slot_id);
+    memcpy(new_slot->key, key.c_str(), 16);
+    new_slot->set_value(internal_value);
+
+    uint32_t g = h & (SIMD_GROUP_NUM - 1);
+    for (uint32_t i = 1; i <= SIMD_GROUP_NUM; i++) {
+      simd_group &grp = m_group[g];
+      grp.lock_.lock_writer();
+      uint32_t m = grp.match_free();
+      if (m) {
+        int pos = __builtin_ctz(m);
+        grp.slot_id_[pos] = new_slot_id;
+        grp.ctrl_[pos] = tag;
+        grp.lock_.unlock_writer();
+        return;
+      }
+      grp.lock_.unlock_writer();
+      g = (g + i) & (SIMD_GROUP_NUM - 1);
+    }
+    // 所有group都满了: 丢掉key会泄漏它的index slot, 只能退出
+    fprintf(stderr, "simd_hash_map: table is full, %d slots\n", SIMD_GROUP_NUM * SIMD_GROUP_SLOTS);
+    abort();
+  }
+
+  /* Same prefetch interface as hash_map_t: the home group, then the slot of
+     the first tag match in it. */
+  void prefetch_bucket(uint64_t h) {
+    __builtin_prefetch(&m_group[h & (SIMD_GROUP_NUM - 1)]);
+  }
+
+  void prefetch_head(uint64_t h) {
+    simd_group &grp = m_group[h & (SIMD_GROUP_NUM - 1)];
+    uint32_t m = grp.match(simd_tag(h));
+    if (m)
+      __builtin_prefetch(global_slot_array->at(READ_ONCE(grp.slot_id_[__builtin_ctz(m)])));
+  }
+
+  /* Visit every slot, insert/remove must be kept out meanwhile. */
+  template <typename F>
+  void for_each(F f) {
+    for (uint32_t g = 0; g < SIMD_GROUP_NUM; g++) {
+      uint32_t m = ~m_group[g].match_free() & ((1u << SIMD_GROUP_SLOTS) - 1);
+      while (m) {
+        f(global_slot_array->at(m_group[g].slot_id_[__builtin_ctz(m)]));
+        m &= m - 1;
+      }
+    }
+  }
+
+  uint64_t mem_use() const { return sizeof(*this) + SIMD_GROUP_BYTES; }
+
+  // if not exist or delete fail, return -1, else return kv_slot_id
+  int remove(const std::string &key) {
+    return remove(key, kv_hash(key));
+  }
+
+  int remove(const std::string &key, uint64_t h) {
+    uint8_t tag = simd_tag(h);
+    uint32_t g = h & (SIMD_GROUP_NUM - 1);
+    for (uint32_t i = 1; i <= SIMD_GROUP_NUM; i++) {
+      simd_group &grp = m_group[g];
+      grp.lock_.lock_writer();
+      uint32_t m = grp.match(tag);
+      bool has_empty = grp.match(SIMD_CTRL_EMPTY) != 0;
+      while (m) {
+        int pos = __builtin_ctz(m);
+        int slot_id = grp.slot_id_[pos];
+        if (memcmp(global_slot_array->at(slot_id)->key, key.c_str(), 16) == 0) {
+          /* A group that still has an empty slot has never been full, so no
+             probe sequence passes through it and no tombstone is needed. */
+          grp.ctrl_[pos] = has_empty ? SIMD_CTRL_EMPTY : SIMD_CTRL_DELETED;
+          grp.lock_.unlock_writer();
+          return slot_id;
+        }
+        m &= m - 1;
+      }
+      grp.lock_.unlock_writer();
+      if (has_empty) break;
+      g = (g + i) & (SIMD_GROUP_NUM - 1);
+    }
+    return -1;
+  }
+};
+
+}  // namespace kv
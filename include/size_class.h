@@ -0,0 +1,127 @@
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+// #define USE_ADAPTIVE_SIZE_CLASS // 按采样的value size分布重新划分size class, 否则固定16B一级
+
+#define PAGE_LEVELS 64 // size class 数量上限
+#define SLOT_GRANULE 16 // slot size 都是16B的整数倍
+#define MIN_SLOT_SIZE 96
+#define MAX_SLOT_SIZE (80 + PAGE_LEVELS * SLOT_GRANULE) // 1104B, 更大的value不支持
+#define SLOT_GRANULES (MAX_SLOT_SIZE / SLOT_GRANULE + 1)
+
+#define SIZE_CLASS_SAMPLE_SHIFT 6 // 每个线程每64次分配采样一次value size
+#define SIZE_CLASS_REBUILD_SAMPLES (1 << 16) // 每采样这么多次重新计算一次size class
+#define SIZE_CLASS_MIN_GAIN 0.9 // 新划分的代价低于当前的90%才切换, 避免来回抖动
+
+namespace kv {
+
+/* Smallest slot granule that holds a value of size bytes. */
+static inline int size_granule(uint32_t size) {
+  int g = (size + SLOT_GRANULE - 1) / SLOT_GRANULE;
+  return g < MIN_SLOT_SIZE / SLOT_GRANULE ? MIN_SLOT_SIZE / SLOT_GRANULE : g;
+}
+
+/* A set of size classes: slot_size[0..num) ascending, the last one is always
+   MAX_SLOT_SIZE so every supported value has a class. Tables are immutable
+   once published, a change installs a new table with a higher version. */
+struct size_class_table {
+  uint32_t version = 0;
+  int num = 0;
+  uint16_t slot_size[PAGE_LEVELS];
+  uint8_t class_of[SLOT_GRANULES]; // value size granule -> class
+  int8_t index_of[SLOT_GRANULES]; // slot size granule -> class, -1: 不是当前的class
+
+  /* 80B起每16B一级, 与原先固定的分级相同 */
+  static size_class_table *uniform() {
+    size_class_table *t = new size_class_table();
+    for (int g = MIN_SLOT_SIZE / SLOT_GRANULE; g <= MAX_SLOT_SIZE / SLOT_GRANULE; g++) {
+      t->slot_size[t->num++] = g * SLOT_GRANULE;
+    }
+    t->build_index();
+    return t;
+  }
+
+  void build_index() {
+    assert(num > 0 && num <= PAGE_LEVELS && slot_size[num - 1] == MAX_SLOT_SIZE);
+    memset(class_of, 0, sizeof(class_of));
+    memset(index_of, -1, sizeof(index_of));
+    int c = 0;
+    for (int g = 0; g < SLOT_GRANULES; g++) {
+      while (slot_size[c] < g * SLOT_GRANULE) c++;
+      class_of[g] = c;
+    }
+    for (int i = 0; i < num; i++) {
+      index_of[slot_size[i] / SLOT_GRANULE] = i;
+    }
+  }
+
+  int class_of_size(uint32_t size) const { return class_of[size_granule(size)]; }
+
+  /* Cost of serving hist (sampled value size granules, each sample standing
+     for scale bytes per granule of slack) with this table: the slack inside
+     slots plus class_cost for every class that holds values, the partially
+     filled active pages each class keeps per thread. */
+  double cost(const uint64_t *hist, double scale, double class_cost) const {
+    double c = 0;
+    bool used[PAGE_LEVELS] = {false};
+    for (int g = MIN_SLOT_SIZE / SLOT_GRANULE; g < SLOT_GRANULES; g++) {
+      if (hist[g] == 0) continue;
+      int k = class_of[g];
+      used[k] = true;
+      c += hist[g] * (slot_size[k] / SLOT_GRANULE - g) * scale;
+    }
+    for (int k = 0; k < num; k++) c += used[k] ? class_cost : 0;
+    return c;
+  }
+
+  /* The table of minimal cost() for hist, by dynamic programming over the
+     slot granules: best[j] is the cost of covering granules up to j with a
+     class ending exactly at j. Every class pays class_cost, so no class
+     without values is made (besides the MAX_SLOT_SIZE one). Returns nullptr
+     if hist is empty. */
+  static size_class_table *optimal(const uint64_t *hist, double scale, double class_cost) {
+    const int lo = MIN_SLOT_SIZE / SLOT_GRANULE, hi = MAX_SLOT_SIZE / SLOT_GRANULE;
+    int last = -1;
+    // cnt/wsum: 前缀和, 区间(i, j]放进slot j的浪费为 j*cnt - wsum
+    double cnt[SLOT_GRANULES] = {0}, wsum[SLOT_GRANULES] = {0};
+    for (int g = lo; g <= hi; g++) {
+      cnt[g] = cnt[g - 1] + hist[g];
+      wsum[g] = wsum[g - 1] + (double)hist[g] * g;
+      if (hist[g]) last = g;
+    }
+    if (last == -1) return nullptr;
+
+    double best[SLOT_GRANULES];
+    int from[SLOT_GRANULES];
+    best[lo - 1] = 0;
+    for (int j = lo; j <= last; j++) {
+      best[j] = -1;
+      for (int i = lo - 1; i < j; i++) {
+        double n = cnt[j] - cnt[i];
+        double c = best[i] + (j * n - (wsum[j] - wsum[i])) * scale + class_cost;
+        if (best[j] < 0 || c < best[j]) {
+          best[j] = c;
+          from[j] = i;
+        }
+      }
+    }
+
+    size_class_table *t = new size_class_table();
+    uint16_t rev[PAGE_LEVELS];
+    int n = 0;
+    for (int j = last; j >= lo; j = from[j]) rev[n++] = j * SLOT_GRANULE;
+    for (int i = n - 1; i >= 0; i--) t->slot_size[t->num++] = rev[i];
+    if (last < hi) t->slot_size[t->num++] = MAX_SLOT_SIZE; // 没有采样到的大value也要能分配
+    t->build_index();
+    return t;
+  }
+
+  bool same_classes(const size_class_table &o) const {
+    return num == o.num && memcmp(slot_size, o.slot_size, num * sizeof(slot_size[0])) == 0;
+  }
+};
+
+}  // namespace kv
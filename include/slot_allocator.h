@@ -0,0 +1,230 @@
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "conqueue.h"
+
+#define SLOT_MAGAZINE_SIZE 256
+#define SLOT_ALLOC_MAX_THREADS 128
+
+namespace kv {
+
+/* A fixed size stack of free slot ids. */
+struct slot_magazine {
+  int count = 0;
+  int ids[SLOT_MAGAZINE_SIZE];
+  bool full() const { return count == SLOT_MAGAZINE_SIZE; }
+  bool empty() const { return count == 0; }
+};
+
+/* Slot id allocator with per-thread magazines (Bonwick/Adams).
+   Each thread owns a loaded and a previous magazine, alloc/free are a
+   push/pop on them. Only when both are exhausted (or both full) a whole
+   magazine is exchanged:
+     alloc: loaded -> prev -> own spare -> depot -> other threads' spares
+            -> fresh ids from the bump pointer
+     free:  loaded -> prev -> own spare -> depot
+   The spare is the one full magazine a thread parks in an atomic, so an
+   idle thread's surplus can be stolen by a thread that ran dry.
+   A thread holds its cache only while it lives: on exit its magazines go
+   to the depots and the cache is reused by the next new thread. More than
+   SLOT_ALLOC_MAX_THREADS threads alive at once is fatal. */
+class slot_allocator {
+ public:
+  explicit slot_allocator(int max_slots) : max_slots_(max_slots) { registry().add(this); }
+  slot_allocator(const slot_allocator &) = delete;
+  slot_allocator &operator=(const slot_allocator &) = delete;
+
+  ~slot_allocator() {
+    registry().remove(this);
+    for (auto &c : caches_) {
+      delete c.loaded;
+      delete c.prev;
+      delete c.spare.load();
+    }
+    slot_magazine *m;
+    while (full_depot_.try_dequeue(m)) delete m;
+    while (empty_depot_.try_dequeue(m)) delete m;
+  }
+
+  // return -1 if every slot id is in use
+  int alloc() {
+    thread_cache &c = cache();
+    if (!c.loaded->empty())
+      return c.loaded->ids[--c.loaded->count];
+    if (!c.prev->empty()) {
+      std::swap(c.loaded, c.prev);
+      return c.loaded->ids[--c.loaded->count];
+    }
+    slot_magazine *m = c.spare.exchange(nullptr, std::memory_order_acquire);
+    if (m == nullptr && !full_depot_.try_dequeue(m))
+      m = steal();
+    if (m == nullptr)
+      m = bump();
+    if (m == nullptr)
+      return -1;
+    empty_depot_.enqueue(c.prev);
+    c.prev = c.loaded;
+    c.loaded = m;
+    return c.loaded->ids[--c.loaded->count];
+  }
+
+  void free(int slot_id) {
+    thread_cache &c = cache();
+    if (c.loaded->full()) {
+      if (c.prev->empty()) {
+        std::swap(c.loaded, c.prev);
+      } else {
+        slot_magazine *old = nullptr;
+        if (!c.spare.compare_exchange_strong(old, c.prev, std::memory_order_release))
+          full_depot_.enqueue(c.prev);
+        c.prev = c.loaded;
+        c.loaded = new_empty();
+      }
+    }
+    c.loaded->ids[c.loaded->count++] = slot_id;
+  }
+
+  int bump_pos() const { return bump_.load(std::memory_order_relaxed); }
+
+ private:
+  struct alignas(64) thread_cache {
+    slot_magazine *loaded = nullptr;
+    slot_magazine *prev = nullptr;
+    std::atomic<slot_magazine *> spare{nullptr};
+  };
+
+  /* Cache ids of the live threads, the same id in every allocator. */
+  struct thread_registry {
+    std::mutex lock;
+    std::vector<slot_allocator *> allocators;
+    bool used[SLOT_ALLOC_MAX_THREADS] = {false};
+
+    void add(slot_allocator *a) {
+      std::lock_guard<std::mutex> guard(lock);
+      allocators.push_back(a);
+    }
+
+    void remove(slot_allocator *a) {
+      std::lock_guard<std::mutex> guard(lock);
+      for (size_t i = 0; i < allocators.size(); i++) {
+        if (allocators[i] == a) {
+          allocators[i] = allocators.back();
+          allocators.pop_back();
+          break;
+        }
+      }
+    }
+
+    int acquire() {
+      std::lock_guard<std::mutex> guard(lock);
+      for (int i = 0; i < SLOT_ALLOC_MAX_THREADS; i++) {
+        if (!used[i]) {
+          used[i] = true;
+          return i;
+        }
+      }
+      fprintf(stderr, "slot_allocator: more than %d threads alive\n", SLOT_ALLOC_MAX_THREADS);
+      abort();
+    }
+
+    void release(int tid) {
+      std::lock_guard<std::mutex> guard(lock);
+      for (slot_allocator *a : allocators) a->drain(tid);
+      used[tid] = false;
+    }
+  };
+
+  static thread_registry &registry() {
+    static thread_registry r;
+    return r;
+  }
+
+  /* Gives the cache id back when the thread exits. */
+  struct thread_slot {
+    int tid = -1;
+    ~thread_slot() {
+      if (tid != -1) registry().release(tid);
+    }
+  };
+
+  /* The thread of cache tid exited: its ids go to the depots, where any
+     thread finds them. Under the registry lock. */
+  void drain(int tid) {
+    thread_cache &c = caches_[tid];
+    slot_magazine *mags[3] = {c.loaded, c.prev, c.spare.exchange(nullptr, std::memory_order_acquire)};
+    for (slot_magazine *m : mags) {
+      if (m == nullptr) continue;
+      if (m->empty())
+        empty_depot_.enqueue(m);
+      else
+        full_depot_.enqueue(m); // 可能没满, alloc只按count取
+    }
+    c.loaded = nullptr;
+    c.prev = nullptr;
+  }
+
+  thread_cache &cache() {
+    static thread_local thread_slot slot;
+    if (slot.tid == -1) {
+      slot.tid = registry().acquire();
+    }
+    int tid = slot.tid;
+    thread_cache &c = caches_[tid];
+    if (c.loaded == nullptr) {
+      c.loaded = new_empty();
+      c.prev = new_empty();
+      int n = thread_num_.load(std::memory_order_relaxed);
+      while (n < tid + 1 && !thread_num_.compare_exchange_weak(n, tid + 1)) {}
+    }
+    return c;
+  }
+
+  slot_magazine *new_empty() {
+    slot_magazine *m;
+    if (!empty_depot_.try_dequeue(m))
+      m = new slot_magazine();
+    assert(m->empty());
+    return m;
+  }
+
+  slot_magazine *steal() {
+    int n = thread_num_.load(std::memory_order_acquire);
+    for (int i = 0; i < n; i++) {
+      if (caches_[i].spare.load(std::memory_order_relaxed) == nullptr)
+        continue;
+      slot_magazine *m = caches_[i].spare.exchange(nullptr, std::memory_order_acquire);
+      if (m) return m;
+    }
+    return nullptr;
+  }
+
+  /* A full magazine of never used ids. */
+  slot_magazine *bump() {
+    int start = bump_.fetch_add(SLOT_MAGAZINE_SIZE, std::memory_order_relaxed);
+    if (start >= max_slots_) {
+      bump_.fetch_sub(SLOT_MAGAZINE_SIZE, std::memory_order_relaxed);
+      return nullptr;
+    }
+    slot_magazine *m = new_empty();
+    int end = std::min(start + SLOT_MAGAZINE_SIZE, max_slots_);
+    // 倒序压栈, 先分配小id
+    for (int id = end - 1; id >= start; id--) m->ids[m->count++] = id;
+    return m;
+  }
+
+  const int max_slots_;
+  std::atomic<int> bump_{0};
+  std::atomic<int> thread_num_{0};
+  moodycamel::ConcurrentQueue<slot_magazine *> full_depot_;
+  moodycamel::ConcurrentQueue<slot_magazine *> empty_depot_;
+  thread_cache caches_[SLOT_ALLOC_MAX_THREADS];
+};
+
+}  // namespace kv
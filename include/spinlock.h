@@ -22,6 +22,8 @@ class Spinlock {
       }
   }
 
+  bool try_lock() { return !flag.test_and_set(std::memory_order_acquire); }
+
   void unlock() { flag.clear(std::memory_order_release); }
 
   private:
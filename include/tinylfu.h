@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+// #define USE_TINYLFU // cacheline cache 按访问频率决定是否接纳新line, 顺序扫描冲不掉热数据
+
+#define TINYLFU_MAX_FREQ 15 // 计数上限, 4 bit就够区分冷热
+#define TINYLFU_SAMPLE_FACTOR 10 // 每记录 cache容量*10 次访问, 所有计数减半
+#define TINYLFU_WINDOW_PERCENT 1 // W-TinyLFU: window LRU 占cache的比例, 至少一条line
+
+namespace kv {
+
+/* TinyLFU admission filter: a count-min sketch of how often each key (cache
+   line address) was accessed lately. On a miss the cache asks admit() with
+   the key it would load and the key it would evict, the more frequent one
+   stays. A scan touches each line once, so its lines never push out lines
+   that are accessed again and again.
+   Counters saturate at TINYLFU_MAX_FREQ and are all halved every
+   TINYLFU_SAMPLE_FACTOR * capacity records, so the sketch follows shifts
+   of the hot set. record() is a relaxed load/store per row, concurrent
+   increments of one counter may get lost, which only makes the estimate a
+   bit lower. */
+class TinyLFU {
+ public:
+  explicit TinyLFU(uint64_t capacity) {
+    width_ = 64;
+    while (width_ < capacity * 16) width_ <<= 1;
+    counters_ = new std::atomic<uint8_t>[width_];
+    for (uint64_t i = 0; i < width_; i++) counters_[i].store(0, std::memory_order_relaxed);
+    sample_ = capacity * TINYLFU_SAMPLE_FACTOR;
+  }
+
+  ~TinyLFU() { delete[] counters_; }
+
+  TinyLFU(const TinyLFU &) = delete;
+  TinyLFU &operator=(const TinyLFU &) = delete;
+
+  /* key was accessed. */
+  void record(uint64_t key) {
+    uint64_t h = mix(key);
+    for (int i = 0; i < DEPTH; i++) {
+      std::atomic<uint8_t> &c = counters_[index(h, i)];
+      uint8_t v = c.load(std::memory_order_relaxed);
+      if (v < TINYLFU_MAX_FREQ) c.store(v + 1, std::memory_order_relaxed);
+    }
+    if (records_.fetch_add(1, std::memory_order_relaxed) + 1 == sample_) {
+      age();
+    }
+  }
+
+  /* Estimated number of recent accesses of key. */
+  uint32_t frequency(uint64_t key) const {
+    uint64_t h = mix(key);
+    uint32_t f = TINYLFU_MAX_FREQ;
+    for (int i = 0; i < DEPTH; i++) {
+      uint32_t v = counters_[index(h, i)].load(std::memory_order_relaxed);
+      if (v < f) f = v;
+    }
+    return f;
+  }
+
+  /* Should candidate replace victim in the cache. */
+  bool admit(uint64_t candidate, uint64_t victim) const { return frequency(candidate) > frequency(victim); }
+
+ private:
+  static const int DEPTH = 4;
+
+  static uint64_t mix(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ull;
+    key ^= key >> 33;
+    return key;
+  }
+
+  /* 第i个hash函数用hash的第i个16位, 共用一张计数表 */
+  uint64_t index(uint64_t h, int i) const {
+    uint64_t x = (h >> (i * 16)) * 0x9E3779B97F4A7C15ull;
+    return (x >> 32) & (width_ - 1);
+  }
+
+  /* 所有计数减半, 由凑满sample_的那次record执行 */
+  void age() {
+    for (uint64_t i = 0; i < width_; i++) {
+      counters_[i].store(counters_[i].load(std::memory_order_relaxed) >> 1, std::memory_order_relaxed);
+    }
+    records_.fetch_sub(sample_, std::memory_order_relaxed);
+  }
+
+  std::atomic<uint8_t> *counters_;
+  uint64_t width_; // 每行的计数器个数, 2的幂
+  uint64_t sample_;
+  std::atomic<uint64_t> records_{0};
+};
+
+}  // namespace kv
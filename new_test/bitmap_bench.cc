@@ -0,0 +1,148 @@
+#include "bitmap.h"
+#include <assert.h>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+// bitmap microbenchmark: 分层bitmap与原先逐word线性扫描的get_free对比
+// usage: bitmap_bench [threads]
+
+using namespace std;
+
+namespace legacy {
+
+// 原实现: 每次从第0个word开始线性扫描
+struct bitmap {
+  unsigned long cnt, free_cnt, siz;
+  vector<unsigned long> data;
+};
+
+static bitmap *create_bitmap(unsigned long cnt) {
+  bitmap *bp = new bitmap();
+  bp->cnt = bp->free_cnt = cnt;
+  bp->siz = ALIGN_UP(cnt, 64);
+  bp->data.assign(bp->siz / 64, 0);
+  for (unsigned long i = cnt; i < bp->siz; i++) bp->data[i >> 6] |= 1UL << (i & 63);
+  return bp;
+}
+
+static int get_free(bitmap *bp) {
+  unsigned long old_free_cnt, old_val, j;
+  do {
+    old_free_cnt = bp->free_cnt;
+    if (old_free_cnt == 0) return -1;
+  } while (!cmpxchg(&bp->free_cnt, old_free_cnt, old_free_cnt - 1));
+  for (unsigned long i = 0; i < bp->siz / 64; i++) {
+    for (;;) {
+      old_val = bp->data[i];
+      if (old_val == (unsigned long)-1) break;
+      j = __builtin_ffsl(old_val + 1) - 1;
+      if (cmpxchg(&bp->data[i], old_val, old_val | (1UL << j))) return (i << 6) | j;
+    }
+  }
+  assert(false);
+  return 0;
+}
+
+// 直接置位前n个bit, 避免用 O(n) 的get_free填充
+static void fill(bitmap *bp, unsigned long n) {
+  for (unsigned long i = 0; i < n; i++) bp->data[i >> 6] |= 1UL << (i & 63);
+  bp->free_cnt -= n;
+}
+
+static void put_back(bitmap *bp, int bk) {
+  unsigned long old_val;
+  do {
+    old_val = bp->data[bk >> 6];
+  } while (!cmpxchg(&bp->data[bk >> 6], old_val, old_val ^ (1UL << (bk & 63))));
+  atomic_inc(&bp->free_cnt);
+}
+
+}  // namespace legacy
+
+static double now_ns() {
+  return chrono::duration<double, nano>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 前90%的bit已分配, 随机释放一个再分配一个, 返回每对操作的ns
+template <typename B, typename Get, typename Put>
+static double churn(B *b, unsigned long cnt, long ops, Get get, Put put) {
+  vector<int> used;
+  used.reserve(cnt);
+  for (unsigned long i = 0; i < cnt * 9 / 10; i++) used.push_back(i);
+  mt19937_64 rng(42);
+  double t = now_ns();
+  for (long i = 0; i < ops; i++) {
+    size_t k = rng() % used.size();
+    put(b, used[k]);
+    used[k] = get(b);
+    assert(used[k] >= 0);
+  }
+  return (now_ns() - t) / ops;
+}
+
+int main(int argc, char **argv) {
+  int threads = argc > 1 ? atoi(argv[1]) : 8;
+
+  // 顺序分配得到连续的slot
+  {
+    kv::bitmap *b = kv::create_bitmap(192000000ul);
+    for (int i = 0; i < 10000000; i++) {
+      int slot = kv::get_free(b);
+      assert(i == slot);
+      (void)slot;
+    }
+    kv::free_bitmap(b);
+  }
+
+  const unsigned long sizes[] = {10912 /* 1MB page of 96B slots */, 1ul << 17, 1ul << 20, 192000000ul};
+  cout << "bits\tlevels ns/op\tlinear ns/op" << endl;
+  for (unsigned long cnt : sizes) {
+    long ops = 1 << 20;
+    kv::bitmap *b = kv::create_bitmap(cnt);
+    for (unsigned long i = 0; i < cnt * 9 / 10; i++) kv::get_free(b);
+    double t_new = churn(b, cnt, ops, [](kv::bitmap *p) { return kv::get_free(p); },
+                         [](kv::bitmap *p, int k) { kv::put_back(p, k); });
+    kv::free_bitmap(b);
+
+    // 线性扫描在大bitmap上太慢, 限制总扫描量
+    long legacy_ops = max(1000l, (long)((1ul << 30) / (cnt / 64 + 1)));
+    legacy_ops = min(legacy_ops, ops);
+    legacy::bitmap *lb = legacy::create_bitmap(cnt);
+    legacy::fill(lb, cnt * 9 / 10);
+    double t_old = churn(lb, cnt, legacy_ops, [](legacy::bitmap *p) { return legacy::get_free(p); },
+                         [](legacy::bitmap *p, int k) { legacy::put_back(p, k); });
+    delete lb;
+    cout << cnt << "\t" << t_new << "\t\t" << t_old << endl;
+  }
+
+  // 多线程在同一个bitmap上分配/释放, 每个线程用自己的hint
+  {
+    const unsigned long cnt = 1ul << 20;
+    const long ops = 1 << 20;
+    kv::bitmap *b = kv::create_bitmap(cnt);
+    vector<thread> th;
+    double t = now_ns();
+    for (int i = 0; i < threads; i++) {
+      th.emplace_back([&, i] {
+        unsigned int hint = (b->sum_words / threads) * i;
+        vector<int> mine;
+        for (unsigned long k = 0; k < cnt * 8 / 10 / threads; k++) mine.push_back(kv::get_free(b, &hint));
+        mt19937_64 rng(i);
+        for (long k = 0; k < ops; k++) {
+          size_t x = rng() % mine.size();
+          kv::put_back(b, mine[x]);
+          mine[x] = kv::get_free(b, &hint);
+          assert(mine[x] >= 0);
+        }
+      });
+    }
+    for (auto &x : th) x.join();
+    double per = (now_ns() - t) / ops;
+    cout << threads << " threads, " << cnt << " bits: " << per << " ns per op per thread" << endl;
+    kv::free_bitmap(b);
+  }
+  return 0;
+}
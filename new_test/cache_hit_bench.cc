@@ -0,0 +1,105 @@
+#include "page.h"
+#include "lru_cache.h"
+#include "clock_cache.h"
+#include "concurrent_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+// cacheline cache 命中的吞吐随线程数的变化: 先把 HOT_LINES 条line读进cache,
+// 然后各线程在这些line上随机读 VALUE_SIZE 的value, 每次都命中, 跑 RUN_MS 毫秒.
+// 远端内存用本地数组模拟.
+// usage: cache_hit_bench [max_threads]
+
+#define HOT_LINES (CACHELINE_NUMS / 2)
+#define VALUE_SIZE 100
+#define RUN_MS 500
+
+using namespace std;
+using namespace kv;
+
+static char *remote_mem;
+
+namespace kv {
+
+int ConnectionManager::remote_read(void *ptr, uint32_t size, uint64_t remote_addr, uint32_t rkey) {
+  memcpy(ptr, remote_mem + remote_addr, size);
+  return 0;
+}
+
+int ConnectionManager::remote_write(void *ptr, uint32_t size, uint64_t remote_addr, uint32_t rkey) {
+  memcpy(remote_mem + remote_addr, ptr, size);
+  return 0;
+}
+
+}  // namespace kv
+
+/* thread_num 个线程一起读命中的value, 返回每秒百万次 */
+template <typename Cache>
+static double hit_mops(Cache &cache, int thread_num) {
+  atomic<bool> start{false}, stop{false};
+  atomic<uint64_t> total{0};
+  vector<thread> threads;
+  for (int t = 0; t < thread_num; t++) {
+    threads.emplace_back([&, t] {
+      mt19937_64 rng(t);
+      char buf[VALUE_SIZE];
+      uint64_t n = 0;
+      while (!start.load()) {
+      }
+      while (!stop.load(std::memory_order_relaxed)) {
+        uint64_t r = rng();
+        uint64_t addr = (r % HOT_LINES + 1) * CACHELINE_SIZE;
+        uint32_t offset = (r >> 32) % (CACHELINE_SIZE / VALUE_SIZE) * VALUE_SIZE;
+        cache.Find(addr, 1, offset, VALUE_SIZE, buf);
+        n++;
+      }
+      total += n;
+    });
+  }
+  start = true;
+  this_thread::sleep_for(chrono::milliseconds(RUN_MS));
+  stop = true;
+  for (auto &th : threads) th.join();
+  return total / (RUN_MS * 1000.0);
+}
+
+template <typename Cache>
+static void run(const char *name, Cache &cache, int max_threads) {
+  char buf[VALUE_SIZE];
+  for (int i = 0; i < HOT_LINES; i++) {
+    cache.Find((i + 1) * CACHELINE_SIZE, 1, 0, VALUE_SIZE, buf);
+  }
+  for (int n = 1; n <= max_threads; n *= 2) {
+    uint64_t h0, m0, h1, m1;
+    cache.stats(h0, m0);
+    double mops = hit_mops(cache, n);
+    cache.stats(h1, m1);
+    printf("%-22s %2d threads: %6.1f Mops/s, misses %lu\n", name, n, mops, m1 - m0);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int max_threads = argc > 1 ? atoi(argv[1]) : (int)thread::hardware_concurrency();
+  remote_mem = (char *)calloc(HOT_LINES + 1, CACHELINE_SIZE);
+  ConnectionManager conn;
+  {
+    LRUCache cache(CACHELINE_NUMS, &conn, nullptr);
+    run("LRUCache", cache, max_threads);
+  }
+  {
+    ClockCache cache(&conn);
+    run("ClockCache", cache, max_threads);
+  }
+  {
+    ConcurrentClockCache cache(CACHELINE_NUMS, &conn);
+    run("ConcurrentClockCache", cache, max_threads);
+  }
+  free(remote_mem);
+  return 0;
+}
@@ -13,6 +13,7 @@
 #include "test.h"
 #include "zipf.h"
 #include "logging.h"
+#include "perf_counter.h"
 
 using namespace kv;
 using namespace std;
@@ -333,14 +334,18 @@ void part2(LocalEngine *local_engine, TestKey *keys, int *zipf_index, int *key_s
       threads.emplace_back(
           [=](TestKey *k, int *zipf_index, int *slab_class) {
             bindCore(i);
-            for (int j = 0; j < delete_op_per_thread; j++) {
-              int key_idx = j + i * delete_op_per_thread;
-              // if (j % (4 * M) == 0) {
-              //   LOG_INFO("[thread %d] finish read deleted %d M kv", i, j / M);
-              // }
-              std::string value;
-              bool found = local_engine->read(keys[key_idx].to_string(), value);
-              ASSERT(!found, "delete key %.16s failed.", keys[key_idx].key);
+            // 批量校验，索引查找走 read_batch 的预取路径
+            const int batch = 64;
+            std::string batch_keys[batch], values[batch];
+            bool found[batch];
+            for (int j = 0; j < delete_op_per_thread; j += batch) {
+              int cnt = std::min(batch, delete_op_per_thread - j);
+              for (int b = 0; b < cnt; b++)
+                batch_keys[b] = keys[j + b + i * delete_op_per_thread].to_string();
+              local_engine->read_batch(batch_keys, cnt, values, found);
+              for (int b = 0; b < cnt; b++) {
+                ASSERT(!found[b], "delete key %.16s failed.", keys[j + b + i * delete_op_per_thread].key);
+              }
             }
           },
           keys, zipf_index, key_slab_class);
@@ -461,9 +466,24 @@ size_t physical_memory_used_by_process()
 }
 
 int main() {
+#ifdef USE_SIMD_HASH_MAP
+  LOG_INFO("Index: simd_hash_map_t (open addressing)");
+#elif defined(USE_LOCKFREE_HASH_MAP)
+  LOG_INFO("Index: lockfree_hash_map_t (lock-free chained)");
+#else
+  LOG_INFO("Index: hash_map_t (chained)");
+#endif
+  LOG_INFO("Index slot: %zu B", sizeof(hash_map_slot));
+  // 统计启动耗时和整个测试过程的dTLB miss, 用于对比索引内存布局
+  PerfCounter dtlb_miss = PerfCounter::dtlb_load_miss();
+  if (!dtlb_miss.valid())
+    LOG_INFO("dTLB counter unavailable, check perf_event_paranoid");
+  auto start_time = std::chrono::steady_clock::now();
   LocalEngine *local_engine = new LocalEngine();
   // ip 必须写具体ip，不能直接写localhost和127.0.0.1
   local_engine->start("192.168.200.22", "23627");
+  LOG_INFO("Engine start time: %ld ms", (long)std::chrono::duration_cast<std::chrono::milliseconds>(
+                                             std::chrono::steady_clock::now() - start_time).count());
   LOG_INFO("Engine Use DRAM Space: %lf GB", ((double)physical_memory_used_by_process())/1024.0/1024.0);
   std::vector<std::thread> threads;
   std::mutex zipf_mutex;
@@ -495,9 +515,13 @@ int main() {
 
   LOG_INFO(" end gen zipf key!");
 
+  dtlb_miss.start();
   part1(local_engine, keys, zipf_index, key_slab_class, threads);
+  LOG_INFO("part1 dTLB load miss: %lu", dtlb_miss.stop());
   local_engine->Info();
+  dtlb_miss.start();
   part2(local_engine, keys, zipf_index, key_slab_class, threads);
+  LOG_INFO("part2 dTLB load miss: %lu", dtlb_miss.stop());
   local_engine->Info();
   // part3(local_engine, keys, zipf_index, key_slab_class, threads);
   // local_engine->Info();
@@ -0,0 +1,107 @@
+#include "extent_allocator.h"
+#include <stdio.h>
+#include <atomic>
+
+// ExtentAllocator: 释放的范围与前后相邻的空闲范围合并, 全空的region留一块备用
+// 远端注册用假的ConnectionManager, 地址单调增
+// usage: ./extent_test
+
+using namespace kv;
+
+static std::atomic<uint64_t> fake_addr{1ul << 30};
+static std::atomic<int> reg_calls{0};
+static std::atomic<int> unreg_calls{0};
+static int failed = 0;
+
+namespace kv {
+
+int ConnectionManager::register_remote_memory(uint64_t &addr, uint32_t &rkey, uint64_t size) {
+  addr = fake_addr.fetch_add(size);
+  rkey = 1;
+  reg_calls++;
+  return 0;
+}
+
+int ConnectionManager::unregister_remote_memory(uint64_t addr) {
+  unreg_calls++;
+  return 0;
+}
+
+}  // namespace kv
+
+#define CHECK(cond)                                                   \
+  do {                                                                \
+    if (!(cond)) {                                                    \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      failed++;                                                       \
+    }                                                                 \
+  } while (0)
+
+static uint64_t alloc_at(ExtentAllocator &ea, uint32_t size, uint32_t &id) {
+  bool ret = ea.alloc(size, id);
+  CHECK(ret);
+  return ret ? ea.get(id).addr : 0;
+}
+
+int main() {
+  ConnectionManager conn;
+  PageProvider provider(&conn, 64ul << 30);
+  provider.start();
+  ExtentAllocator ea(&provider);
+  const uint32_t U = EXTENT_UNIT_SIZE;
+  uint32_t a, b, c, x;
+
+  // first fit: a, b, c 在同一个region里依次排开
+  uint64_t base = alloc_at(ea, U, a);
+  CHECK(alloc_at(ea, 2 * U, b) == base + U);
+  CHECK(alloc_at(ea, U, c) == base + 3 * U);
+  CHECK(reg_calls == 1);
+
+  // 中间的洞: 前后都不相邻, 单独一段
+  ea.free(b);
+  CHECK(alloc_at(ea, 2 * U, x) == base + U);
+  ea.free(x);
+
+  // 与后面的空闲范围合并: [a][b的洞] 放得下 3 个单位
+  ea.free(a);
+  CHECK(alloc_at(ea, 3 * U, x) == base);
+  ea.free(x);
+
+  // 与前后都合并: 整个region又是一段, 放得下一个整region大小的extent
+  ea.free(c);
+  CHECK(alloc_at(ea, EXTENT_REGION_SIZE, x) == base);
+  CHECK(reg_calls == 1);
+  ea.free(x);
+
+  // 与前面的空闲范围合并
+  CHECK(alloc_at(ea, U, a) == base);
+  CHECK(alloc_at(ea, U, b) == base + U);
+  CHECK(alloc_at(ea, U, c) == base + 2 * U);
+  ea.free(a);
+  ea.free(b);
+  CHECK(alloc_at(ea, 2 * U, x) == base);
+  ea.free(x);
+  ea.free(c);
+
+  // 两块全空的标准region只留一块, 另一块还给remote
+  uint32_t y;
+  CHECK(alloc_at(ea, EXTENT_REGION_SIZE, x) == base);
+  alloc_at(ea, EXTENT_REGION_SIZE, y);
+  CHECK(reg_calls == 2);
+  ea.free(x);
+  ea.free(y);
+  provider.stop();
+  CHECK(unreg_calls == 1);
+
+  uint64_t extent_num, used_bytes, region_bytes;
+  ea.stats(extent_num, used_bytes, region_bytes);
+  CHECK(extent_num == 0 && used_bytes == 0);
+  CHECK(region_bytes == EXTENT_REGION_SIZE);
+
+  if (failed) {
+    printf("extent_test: %d checks failed\n", failed);
+    return 1;
+  }
+  printf("extent_test: ok\n");
+  return 0;
+}
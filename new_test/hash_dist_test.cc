@@ -0,0 +1,131 @@
+#include "hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <vector>
+
+// 比较 myhash 与 kv_hash 的 shard 负载和桶链长分布
+// usage: ./hash_dist_test [key_num]
+
+#define SHARDING_NUM 173
+#define LEGACY_BUCKET_NUM 1048573
+#define MAX_CHAIN_HIST 8
+
+using namespace std;
+
+// key -> (shard, bucket)
+typedef function<void(const char *, uint32_t &, uint32_t &)> place_fn;
+
+static vector<string> gen_seq_keys(int num) {
+  // 同 new_test/test.h 的 genKey
+  vector<string> keys(num);
+  int a[4];
+  for (int i = 0; i < num; i++) {
+    a[0] = 0x12341234;
+    a[1] = i;
+    a[2] = 0x45674567;
+    a[3] = 0;
+    keys[i].assign((char *)a, 16);
+  }
+  return keys;
+}
+
+static vector<string> gen_random_keys(int num) {
+  vector<string> keys(num);
+  mt19937_64 rng(0x123ab324);
+  uint64_t a[2];
+  for (int i = 0; i < num; i++) {
+    a[0] = rng();
+    a[1] = rng();
+    keys[i].assign((char *)a, 16);
+  }
+  return keys;
+}
+
+static void report(const char *name, const vector<string> &keys, place_fn place) {
+  vector<uint64_t> pos(keys.size());
+  vector<uint64_t> shard_cnt(SHARDING_NUM, 0);
+  for (size_t i = 0; i < keys.size(); i++) {
+    uint32_t s, b;
+    place(keys[i].c_str(), s, b);
+    shard_cnt[s]++;
+    pos[i] = (uint64_t)s << 32 | b;
+  }
+
+  double mean = (double)keys.size() / SHARDING_NUM, var = 0;
+  for (auto c : shard_cnt) var += (c - mean) * (c - mean);
+  auto mm = minmax_element(shard_cnt.begin(), shard_cnt.end());
+
+  // 排序后相同 (shard, bucket) 连续，一段即一条链
+  sort(pos.begin(), pos.end());
+  uint64_t hist[MAX_CHAIN_HIST + 1] = {0};
+  uint64_t max_chain = 0, chains = 0;
+  double cmp = 0; // 命中时平均比较次数
+  for (size_t i = 0; i < pos.size();) {
+    size_t j = i;
+    while (j < pos.size() && pos[j] == pos[i]) j++;
+    uint64_t len = j - i;
+    hist[min<uint64_t>(len, MAX_CHAIN_HIST)]++;
+    max_chain = max(max_chain, len);
+    cmp += len * (len + 1) / 2.0;
+    chains++;
+    i = j;
+  }
+
+  printf("%-16s shard min %lu max %lu cv %.4f | chains %lu max %lu avg_cmp %.3f | hist",
+         name, *mm.first, *mm.second, sqrt(var / SHARDING_NUM) / mean,
+         chains, max_chain, cmp / keys.size());
+  for (int i = 1; i <= MAX_CHAIN_HIST; i++)
+    printf(" %s%d:%lu", i == MAX_CHAIN_HIST ? ">=" : "", i, hist[i]);
+  printf("\n");
+}
+
+static void run(const char *set, const vector<string> &keys) {
+  // 新hash的桶数与 hash_map_t 一致: 每个shard内 2^level 个桶, 平均链长不超过 1
+  uint32_t per_shard = keys.size() / SHARDING_NUM + 1;
+  uint32_t bucket_mask = 1;
+  while (bucket_mask < per_shard) bucket_mask <<= 1;
+  bucket_mask -= 1;
+
+  printf("== %s keys: %lu, buckets per shard: legacy %d, new %u\n", set, keys.size(),
+         LEGACY_BUCKET_NUM, bucket_mask + 1);
+  report("myhash", keys, [](const char *k, uint32_t &s, uint32_t &b) {
+    int h = kv::myhash(string(k, 16));
+    s = h % SHARDING_NUM;
+    b = h % LEGACY_BUCKET_NUM;
+  });
+  report("myhash_pow2", keys, [=](const char *k, uint32_t &s, uint32_t &b) {
+    int h = kv::myhash(string(k, 16));
+    s = h % SHARDING_NUM;
+    b = h & bucket_mask;
+  });
+  report("hash_mix", keys, [=](const char *k, uint32_t &s, uint32_t &b) {
+    uint64_t h = kv::hash_mix(k);
+    s = kv::hash_shard(h, SHARDING_NUM);
+    b = h & bucket_mask;
+  });
+#ifdef __SSE4_2__
+  report("hash_crc32c", keys, [=](const char *k, uint32_t &s, uint32_t &b) {
+    uint64_t h = kv::hash_crc32c(k);
+    s = kv::hash_shard(h, SHARDING_NUM);
+    b = h & bucket_mask;
+  });
+#endif
+#if defined(__AES__) && defined(__SSE4_1__)
+  report("hash_aes", keys, [=](const char *k, uint32_t &s, uint32_t &b) {
+    uint64_t h = kv::hash_aes(k);
+    s = kv::hash_shard(h, SHARDING_NUM);
+    b = h & bucket_mask;
+  });
+#endif
+}
+
+int main(int argc, char *argv[]) {
+  int num = argc > 1 ? atoi(argv[1]) : 12000000;
+  run("sequential", gen_seq_keys(num));
+  run("random", gen_random_keys(num));
+  return 0;
+}
@@ -0,0 +1,144 @@
+#include "page.h"
+#include "lru_cache.h"
+#include "concurrent_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+// LRUCache 并发读写: 每个key只由一个线程写, 同一条cacheline里有各个线程的key.
+// 每次读都应读到本线程最后写的版本, 否则是丢失的更新.
+// 然后均匀地读远多于cache的line, 统计每次读从remote读了多少字节: 开了 USE_CACHE_BYPASS
+// 应接近value大小, 只有很快又miss的line才整条读进cache.
+// 远端内存用本地数组模拟, 统计remote read的次数和字节数 (用 -DUSE_CACHE_BYPASS 编译对比).
+// 用 -DUSE_CONCURRENT_CACHE 编译则测 ConcurrentClockCache.
+// usage: lru_stress [threads] [ops_per_thread]
+
+#define KEY_NUM 200000
+#define SLOT_SIZE 1104 // 最大value + 对齐, 一条cacheline放 SLOTS_PER_LINE 个
+#define SLOTS_PER_LINE (CACHELINE_SIZE / SLOT_SIZE)
+#define HOT_KEYS 200 // HOT_PERCENT 的操作落在每个线程最前面的这么多key上
+#define HOT_PERCENT 50
+#define UNIFORM_LINES (1 << 17) // 均匀读的line数, 超出remote_mem的地址读出全0
+#define UNIFORM_VALUE_SIZE 100
+
+using namespace std;
+using namespace kv;
+
+#ifdef USE_CONCURRENT_CACHE
+typedef ConcurrentClockCache TestCache;
+#define NEW_CACHE(conn) new ConcurrentClockCache(CACHELINE_NUMS, conn)
+#else
+typedef LRUCache TestCache;
+#define NEW_CACHE(conn) new LRUCache(CACHELINE_NUMS, conn, nullptr)
+#endif
+
+static char *remote_mem;
+static uint64_t remote_bytes;
+static atomic<long> remote_reads{0};
+static atomic<long> remote_read_bytes{0};
+
+namespace kv {
+
+int ConnectionManager::remote_read(void *ptr, uint32_t size, uint64_t remote_addr, uint32_t rkey) {
+  remote_reads++;
+  remote_read_bytes += size;
+  if (remote_addr + size > remote_bytes) {
+    memset(ptr, 0, size);
+    return 0;
+  }
+  memcpy(ptr, remote_mem + remote_addr, size);
+  return 0;
+}
+
+int ConnectionManager::remote_write(void *ptr, uint32_t size, uint64_t remote_addr, uint32_t rkey) {
+  memcpy(remote_mem + remote_addr, ptr, size);
+  return 0;
+}
+
+}  // namespace kv
+
+/* 每个线程均匀地读reads个value, 返回平均每次读的remote字节数 */
+static double uniform_read(ConnectionManager *conn, int thread_num, int reads) {
+  TestCache &cache = *NEW_CACHE(conn);
+  long bytes_before = remote_read_bytes;
+  vector<thread> threads;
+  for (int t = 0; t < thread_num; t++) {
+    threads.emplace_back([&, t] {
+      mt19937_64 rng(1000 + t);
+      char buf[UNIFORM_VALUE_SIZE];
+      for (int i = 0; i < reads; i++) {
+        uint64_t r = rng();
+        uint64_t addr = (r % UNIFORM_LINES + 1) * CACHELINE_SIZE;
+        uint32_t offset = (r >> 32) % SLOTS_PER_LINE * SLOT_SIZE;
+        cache.Find(addr, 1, offset, UNIFORM_VALUE_SIZE, buf);
+      }
+    });
+  }
+  for (auto &th : threads) th.join();
+  delete &cache;
+  return (double)(remote_read_bytes - bytes_before) / ((double)thread_num * reads);
+}
+
+int main(int argc, char *argv[]) {
+  int thread_num = argc > 1 ? atoi(argv[1]) : 8;
+  int ops = argc > 2 ? atoi(argv[2]) : 50000;
+  uint64_t line_num = KEY_NUM / SLOTS_PER_LINE + 2;
+  remote_bytes = line_num * CACHELINE_SIZE;
+  remote_mem = (char *)calloc(line_num, CACHELINE_SIZE);
+  ConnectionManager conn;
+  TestCache &cache = *NEW_CACHE(&conn);
+  atomic<long> lost{0};
+
+  vector<thread> threads;
+  for (int t = 0; t < thread_num; t++) {
+    threads.emplace_back([&, t] {
+      mt19937_64 rng(t);
+      vector<uint32_t> size(KEY_NUM, 0);
+      vector<uint32_t> version(KEY_NUM, 0);
+      char buf[SLOT_SIZE], expect[SLOT_SIZE];
+      for (int i = 0; i < ops; i++) {
+        uint64_t r = rng();
+        uint64_t k = r % 100 < HOT_PERCENT ? (r >> 8) % HOT_KEYS : (r >> 8) % (KEY_NUM / thread_num);
+        k = k * thread_num + t; // 第t个线程的key
+        uint64_t addr = (k / SLOTS_PER_LINE + 1) * CACHELINE_SIZE;
+        uint32_t offset = (k % SLOTS_PER_LINE) * SLOT_SIZE;
+        if (size[k] == 0 || (r >> 40) % 8 == 0) {
+          uint32_t s = 96 + (r >> 20) % 1000;
+          version[k]++;
+          memset(buf, 0, s);
+          snprintf(buf, s, "%lu-%u", k, version[k]);
+          if (!cache.Insert(addr, 1, offset, s, buf)) lost++;
+          size[k] = s;
+        } else {
+          memset(expect, 0, size[k]);
+          snprintf(expect, size[k], "%lu-%u", k, version[k]);
+          if (!cache.Find(addr, 1, offset, size[k], buf) || memcmp(buf, expect, size[k]) != 0) lost++;
+        }
+      }
+    });
+  }
+  for (auto &th : threads) th.join();
+
+  printf("%d threads x %d ops: remote reads %ld, %.1f MB, lost updates %ld\n", thread_num, ops, remote_reads.load(),
+         remote_read_bytes.load() / 1048576.0, lost.load());
+
+  delete &cache;
+
+  double per_read = uniform_read(&conn, thread_num, ops);
+  printf("uniform reads of %dB values over %d lines: %.0f bytes read from remote per read\n", UNIFORM_VALUE_SIZE,
+         UNIFORM_LINES, per_read);
+  free(remote_mem);
+  if (lost != 0) return 1;
+#ifdef USE_CACHE_BYPASS
+  // 绝大多数读只读value本身
+  if (per_read > 2 * UNIFORM_VALUE_SIZE) {
+    printf("uniform reads pull whole lines into the cache\n");
+    return 1;
+  }
+#endif
+  return 0;
+}
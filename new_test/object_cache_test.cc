@@ -0,0 +1,119 @@
+#include "object_cache.h"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+// ObjectCache: arena 末尾放不下时填充并从头继续, 命中过的entry被淘汰扫到时挪到队尾一次
+// 远端内存用本地数组模拟, 记录remote read次数
+// usage: ./object_cache_test
+
+#define REMOTE_BASE 4096 // remote地址从这里开始, 地址0在cache里表示作废的entry
+#define REMOTE_BYTES (1 << 20)
+
+using namespace std;
+using namespace kv;
+
+static char remote_mem[REMOTE_BYTES];
+static int remote_reads = 0;
+static int failed = 0;
+
+namespace kv {
+
+int ConnectionManager::remote_read(void *ptr, uint32_t size, uint64_t remote_addr, uint32_t rkey) {
+  remote_reads++;
+  memcpy(ptr, remote_mem + remote_addr - REMOTE_BASE, size);
+  return 0;
+}
+
+int ConnectionManager::remote_write(void *ptr, uint32_t size, uint64_t remote_addr, uint32_t rkey) {
+  memcpy(remote_mem + remote_addr - REMOTE_BASE, ptr, size);
+  return 0;
+}
+
+}  // namespace kv
+
+#define CHECK(cond)                                                   \
+  do {                                                                \
+    if (!(cond)) {                                                    \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      failed++;                                                       \
+    }                                                                 \
+  } while (0)
+
+// 第i个value: 各自一个slot, 内容可辨认
+static uint64_t addr_of(int i) { return REMOTE_BASE + (uint64_t)i * 1024; }
+
+static void insert(ObjectCache &cache, int i, uint32_t size) {
+  string value(size, 'a' + i);
+  CHECK(cache.Insert(addr_of(i), 1, 0, size, value.c_str()));
+}
+
+// value i 是否在cache里, 顺便检查读到的内容; 命中会置上ref位
+static bool cached(ObjectCache &cache, int i, uint32_t size) {
+  string value(size, '\0');
+  int reads = remote_reads;
+  CHECK(cache.Find(addr_of(i), 1, 0, size, &value[0]));
+  CHECK(value == string(size, 'a' + i));
+  return remote_reads == reads;
+}
+
+static void objects_and_bytes(ObjectCache &cache, uint64_t &objects, uint64_t &bytes) {
+  uint64_t hits, misses;
+  cache.stats(hits, misses, objects, bytes);
+}
+
+// 48B value 占一个64B entry, arena 正好4个
+static void test_second_chance() {
+  ObjectCache cache(256, nullptr);
+  for (int i = 0; i < 4; i++) insert(cache, i, 48);
+  CHECK(cached(cache, 0, 48)); // 0 置上ref位
+
+  // 满了: 0 命中过, 挪到队尾(原地)并清掉ref位, 淘汰 1
+  insert(cache, 4, 48);
+  uint64_t objects, bytes;
+  objects_and_bytes(cache, objects, bytes);
+  CHECK(objects == 4 && bytes == 256);
+  CHECK(cached(cache, 0, 48));
+  CHECK(cached(cache, 2, 48));
+  CHECK(cached(cache, 3, 48));
+  CHECK(cached(cache, 4, 48));
+  CHECK(!cached(cache, 1, 48));
+}
+
+static void test_wrap_around() {
+  ObjectCache cache(256, nullptr);
+  for (int i = 0; i < 3; i++) insert(cache, i, 48); // [0,192)
+
+  // 96B entry 在末尾放不下: [192,256) 填充, 从头淘汰 0 和 1 后放在 [0,96)
+  insert(cache, 3, 80);
+  uint64_t objects, bytes;
+  objects_and_bytes(cache, objects, bytes);
+  CHECK(objects == 2 && bytes == 64 + 96 + 64); // 2, 3, 填充
+  CHECK(cached(cache, 2, 48)); // 2 置上ref位
+
+  // 读回来的 0 要64B, [96,128) 不够: 扫到 2, 命中过, 挪到 [96,160);
+  // 再扫到填充, head 回到开头, 0 放在 [160,224)
+  CHECK(!cached(cache, 0, 48));
+  objects_and_bytes(cache, objects, bytes);
+  CHECK(objects == 3 && bytes == 96 + 64 + 64);
+
+  // 4 在末尾 [224,256) 放不下: 再填充, 从头淘汰没命中过的 3
+  insert(cache, 4, 48);
+  objects_and_bytes(cache, objects, bytes);
+  CHECK(objects == 3 && bytes == 64 + 64 + 64 + 32);
+  CHECK(cached(cache, 2, 48));
+  CHECK(cached(cache, 0, 48));
+  CHECK(cached(cache, 4, 48));
+  CHECK(!cached(cache, 3, 80));
+}
+
+int main() {
+  test_second_chance();
+  test_wrap_around();
+  if (failed) {
+    printf("object_cache_test: %d checks failed\n", failed);
+    return 1;
+  }
+  printf("object_cache_test: ok\n");
+  return 0;
+}
@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "conqueue.h"
+#include "rdma_conn_manager.h"
+#include "rdma_mem_pool.h"
+// 直接往各线程队列里放page, 布置倾斜的初始状态
+#define private public
+#include "page_provider.h"
+#undef private
+
+// PageProvider 倾斜负载: 其他线程队列里各有 IDLE_PAGES 个page, 只有线程0连续要page.
+// 远端注册用假的ConnectionManager, 每次注册睡 REG_DELAY_MS 模拟RPC.
+// usage: page_steal_bench [pages]
+
+#define REG_DELAY_MS 5
+#define IDLE_PAGES 64
+
+using namespace std;
+using namespace kv;
+
+static atomic<uint64_t> fake_addr{1ul << 30};
+static atomic<int> reg_calls{0};
+
+namespace kv {
+
+int ConnectionManager::register_remote_memory(uint64_t &addr, uint32_t &rkey, uint64_t size) {
+  this_thread::sleep_for(chrono::milliseconds(REG_DELAY_MS));
+  addr = fake_addr.fetch_add(size);
+  rkey = 1;
+  reg_calls++;
+  return 0;
+}
+
+int ConnectionManager::unregister_remote_memory(uint64_t addr) { return 0; }
+
+}  // namespace kv
+
+int main(int argc, char *argv[]) {
+  int page_num = argc > 1 ? atoi(argv[1]) : 800;
+  ConnectionManager conn;
+  PageProvider provider(&conn, 64ul << 30);
+  provider.start();
+
+  // 其他工作线程写完了, 各自攒着一些page (最后一个队列属于compactor)
+  for (int tid = 1; tid < POOL_THREAD_NUM - 1; tid++) {
+    for (int i = 0; i < IDLE_PAGES; i++) {
+      provider.pages_[tid].enqueue(new Page(fake_addr.fetch_add(RDMA_ALLOCATE_SIZE), 1));
+    }
+  }
+  vector<Page *> pages;
+  int reg_before = reg_calls;
+
+  double max_wait = 0;
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < page_num; i++) {
+    auto t0 = chrono::steady_clock::now();
+    Page *p = provider.get_page(0);
+    if (p == nullptr) {
+      printf("out of remote memory after %d pages\n", i);
+      return 1;
+    }
+    max_wait = max(max_wait, chrono::duration<double, micro>(chrono::steady_clock::now() - t0).count());
+    pages.push_back(p);
+  }
+  double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+  provider.stop();
+
+  sort(pages.begin(), pages.end());
+  bool dup = adjacent_find(pages.begin(), pages.end()) != pages.end();
+  printf("%d pages on thread 0: %.2f ms, max wait %.0f us, registrations %d, duplicate pages %d\n", page_num, ms,
+         max_wait, reg_calls - reg_before, dup);
+  return dup ? 1 : 0;
+}
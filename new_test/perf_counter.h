@@ -0,0 +1,62 @@
+#pragma once
+
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstdint>
+
+// 基于perf_event_open的硬件计数器, 统计本进程(含之后创建的线程)的事件数
+// 无权限(perf_event_paranoid)或不支持时 valid() 为false, read() 返回0
+class PerfCounter {
+ public:
+  PerfCounter(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd_ = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+
+  ~PerfCounter() {
+    if (fd_ >= 0) close(fd_);
+  }
+
+  static PerfCounter dtlb_load_miss() {
+    return PerfCounter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                               (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+  }
+
+  bool valid() const { return fd_ >= 0; }
+
+  void start() {
+    if (fd_ < 0) return;
+    ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+  }
+
+  uint64_t stop() {
+    if (fd_ < 0) return 0;
+    ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+    return read();
+  }
+
+  uint64_t read() const {
+    uint64_t v = 0;
+    if (fd_ < 0 || ::read(fd_, &v, sizeof(v)) != sizeof(v)) return 0;
+    return v;
+  }
+
+  PerfCounter(PerfCounter &&o) : fd_(o.fd_) { o.fd_ = -1; }
+  PerfCounter(const PerfCounter &) = delete;
+  PerfCounter &operator=(const PerfCounter &) = delete;
+
+ private:
+  int fd_;
+};
@@ -0,0 +1,78 @@
+#include "page.h"
+#include "lru_cache.h"
+#include "clock_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+
+// 热点line与顺序扫描混合时 LRUCache/ClockCache 的命中率, 用 -DUSE_TINYLFU 编译对比.
+// 一半的读落在 HOT_LINES 条热点line上, 另一半顺序扫描 SCAN_LINES 条line.
+// 远端内存用本地数组模拟.
+// usage: tinylfu_bench [reads]
+
+#define HOT_LINES 60
+#define SCAN_LINES 3000
+#define VALUE_SIZE 100
+
+using namespace std;
+using namespace kv;
+
+static char *remote_mem;
+
+namespace kv {
+
+int ConnectionManager::remote_read(void *ptr, uint32_t size, uint64_t remote_addr, uint32_t rkey) {
+  memcpy(ptr, remote_mem + remote_addr, size);
+  return 0;
+}
+
+int ConnectionManager::remote_write(void *ptr, uint32_t size, uint64_t remote_addr, uint32_t rkey) {
+  memcpy(remote_mem + remote_addr, ptr, size);
+  return 0;
+}
+
+}  // namespace kv
+
+template <typename Cache>
+static void run(const char *name, Cache &cache, int reads) {
+  mt19937_64 rng(1);
+  char buf[VALUE_SIZE];
+  uint64_t hot_hits = 0, hot_reads = 0, scan = 0;
+  for (int i = 0; i < reads; i++) {
+    bool hot = rng() % 100 < 50;
+    // 第0条line不用, 热点在 [1, HOT_LINES], 扫描的line在它们后面
+    uint64_t line = hot ? 1 + rng() % HOT_LINES : 1 + HOT_LINES + scan++ % SCAN_LINES;
+    uint64_t h0, m0, h1, m1;
+    cache.stats(h0, m0);
+    cache.Find(line * CACHELINE_SIZE, 1, 0, VALUE_SIZE, buf);
+    cache.stats(h1, m1);
+    if (hot) {
+      hot_hits += h1 - h0;
+      hot_reads++;
+    }
+  }
+  uint64_t hits, misses;
+  cache.stats(hits, misses);
+  printf("%s: hit ratio %.3f, hot lines %.3f\n", name, (double)hits / (hits + misses), (double)hot_hits / hot_reads);
+}
+
+int main(int argc, char *argv[]) {
+  int reads = argc > 1 ? atoi(argv[1]) : 400000;
+  remote_mem = (char *)calloc(1 + HOT_LINES + SCAN_LINES, CACHELINE_SIZE);
+#ifdef USE_TINYLFU
+  printf("USE_TINYLFU, %d lines cached\n", CACHELINE_NUMS);
+#else
+  printf("%d lines cached\n", CACHELINE_NUMS);
+#endif
+  {
+    LRUCache lru(CACHELINE_NUMS, nullptr, nullptr);
+    run("LRUCache", lru, reads);
+  }
+  {
+    ClockCache clock(nullptr);
+    run("ClockCache", clock, reads);
+  }
+  free(remote_mem);
+  return 0;
+}
@@ -0,0 +1,145 @@
+#include "extent_allocator.h"
+#include <stdio.h>
+#include "huge_alloc.h"
+
+namespace kv {
+
+ExtentAllocator::ExtentAllocator(PageProvider *provider) : m_page_provider_(provider) {
+  extents_ = (extent_t *)huge_alloc((size_t)MAX_EXTENT_NUM * sizeof(extent_t));
+}
+
+ExtentAllocator::~ExtentAllocator() {
+  for (auto &kv : regions_) {
+    delete kv.second;
+  }
+  huge_free(extents_, (size_t)MAX_EXTENT_NUM * sizeof(extent_t));
+}
+
+bool ExtentAllocator::alloc(uint32_t size, uint32_t &id) {
+  assert(size > 0 && size <= MAX_LARGE_VALUE_SIZE);
+  uint64_t len = (size + EXTENT_UNIT_SIZE - 1) / EXTENT_UNIT_SIZE * EXTENT_UNIT_SIZE;
+  uint64_t addr = 0;
+  Region *region = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (len <= EXTENT_REGION_SIZE) {
+      for (auto &kv : regions_) {
+        if (kv.second->free_bytes >= len && carve(kv.second, len, addr)) {
+          region = kv.second;
+          break;
+        }
+      }
+    }
+  }
+  if (region == nullptr) {
+    // 没有放得下的空间, 向remote要一块新的region
+    Region *r = new Region();
+    r->size = len <= EXTENT_REGION_SIZE ? EXTENT_REGION_SIZE : len;
+    if (!m_page_provider_->get_region(r->size, r->addr, r->rkey)) {
+      delete r;
+      return false;
+    }
+    r->free_bytes = r->size;
+    r->free_ranges[r->addr] = r->size;
+    std::lock_guard<std::mutex> lock(mutex_);
+    regions_[r->addr] = r;
+    bool ret = carve(r, len, addr);
+    assert(ret);
+    region = r;
+  }
+
+  if (!free_ids_.try_dequeue(id)) {
+    id = next_id_++;
+    assert(id < MAX_EXTENT_NUM);
+  }
+  extents_[id].addr = addr;
+  extents_[id].rkey = region->rkey;
+  extents_[id].size = size;
+  extent_num_++;
+  used_bytes_ += size;
+  return true;
+}
+
+void ExtentAllocator::free(uint32_t id) {
+  extent_t e = extents_[id];
+  uint64_t len = (e.size + EXTENT_UNIT_SIZE - 1) / EXTENT_UNIT_SIZE * EXTENT_UNIT_SIZE;
+  extent_num_--;
+  used_bytes_ -= e.size;
+  free_ids_.enqueue(id);
+
+  Region *unused = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto iter = regions_.upper_bound(e.addr);
+    assert(iter != regions_.begin());
+    --iter;
+    Region *r = iter->second;
+    release_range(r, e.addr, len);
+    if (r->free_bytes == r->size) {
+      // 留一块空的标准region备用, 其余还给remote
+      bool spare = false;
+      if (r->size == EXTENT_REGION_SIZE) {
+        spare = true;
+        for (auto &kv : regions_) {
+          if (kv.second != r && kv.second->free_bytes == kv.second->size && kv.second->size == EXTENT_REGION_SIZE) {
+            spare = false;
+            break;
+          }
+        }
+      }
+      if (!spare) {
+        regions_.erase(iter);
+        unused = r;
+      }
+    }
+  }
+  if (unused) {
+    m_page_provider_->put_region(unused->addr, unused->size);
+    delete unused;
+  }
+}
+
+/* First fit in the region, under mutex_. */
+bool ExtentAllocator::carve(Region *r, uint64_t len, uint64_t &addr) {
+  for (auto iter = r->free_ranges.begin(); iter != r->free_ranges.end(); ++iter) {
+    if (iter->second < len) continue;
+    addr = iter->first;
+    uint64_t left = iter->second - len;
+    r->free_ranges.erase(iter);
+    if (left > 0) r->free_ranges[addr + len] = left;
+    r->free_bytes -= len;
+    return true;
+  }
+  return false;
+}
+
+/* Give [addr, addr + len) back to the region, merged with the free ranges
+   around it, under mutex_. */
+void ExtentAllocator::release_range(Region *r, uint64_t addr, uint64_t len) {
+  r->free_bytes += len;
+  auto next = r->free_ranges.lower_bound(addr);
+  if (next != r->free_ranges.end() && addr + len == next->first) {
+    len += next->second;
+    next = r->free_ranges.erase(next);
+  }
+  if (next != r->free_ranges.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == addr) {
+      prev->second += len;
+      return;
+    }
+  }
+  r->free_ranges[addr] = len;
+}
+
+void ExtentAllocator::stats(uint64_t &extent_num, uint64_t &used_bytes, uint64_t &region_bytes) {
+  extent_num = extent_num_.load();
+  used_bytes = used_bytes_.load();
+  region_bytes = 0;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto &kv : regions_) {
+    region_bytes += kv.second->size;
+  }
+}
+
+}  // namespace kv
@@ -1,11 +1,10 @@
 #include <iostream>
 #include "assert.h"
 #include "atomic"
+#include <mutex>
 #include "kv_engine.h"
 namespace kv {
 
-thread_local struct slot_bitmap* cur_slot_bitmap_ = nullptr;
-
 // #define STATISTIC_TIME
 
 #ifdef STATISTIC_TIME
@@ -22,7 +21,53 @@ static inline std::string timeToString(std::chrono::system_clock::time_point &t)
 
 thread_local int my_thread_id = -1;
 
-std::queue<Page*> *page_pool_[THREAD_NUM]; 
+/* Worker ids 0..THREAD_NUM-1 index per-thread state such as the memory
+   pool's active pages and stats, so two live threads must never share one.
+   An id is given back when its thread exits and reused by the next new
+   thread. More than THREAD_NUM workers alive at once is fatal. */
+struct worker_id_registry {
+  std::mutex lock;
+  bool used[THREAD_NUM] = {false};
+
+  int acquire() {
+    std::lock_guard<std::mutex> guard(lock);
+    for (int i = 0; i < THREAD_NUM; i++) {
+      if (!used[i]) {
+        used[i] = true;
+        return i;
+      }
+    }
+    fprintf(stderr, "LocalEngine: more than %d worker threads alive\n", THREAD_NUM);
+    abort();
+  }
+
+  void release(int tid) {
+    std::lock_guard<std::mutex> guard(lock);
+    used[tid] = false;
+  }
+};
+
+static worker_id_registry &worker_ids() {
+  static worker_id_registry r;
+  return r;
+}
+
+/* Gives the worker id back when the thread exits. */
+struct worker_id_slot {
+  int tid = -1;
+  ~worker_id_slot() {
+    if (tid != -1) worker_ids().release(tid);
+  }
+};
+
+static inline void acquire_thread_id() {
+  static thread_local worker_id_slot slot;
+  if (unlikely(-1 == my_thread_id)) {
+    slot.tid = worker_ids().acquire();
+    my_thread_id = slot.tid;
+  }
+}
+
 
 /**
  * @description: start local engine service
@@ -39,6 +84,11 @@ bool LocalEngine::start(const std::string addr, const std::string port) {
     return false;
   }
 
+  // remote内存不再启动时预注册, 由provisioner按需分块注册
+  m_page_provider_ = new PageProvider(m_rdma_conn_, REMOTE_MEM_SPACE);
+  m_page_provider_->start();
+  m_extents_ = new ExtentAllocator(m_page_provider_);
+
   // for (int i = 0; i < SLOT_BITMAP_NUMS; i++) {
   //   bitmap *p = create_bitmap(KV_NUMS/SLOT_BITMAP_NUMS);
   //   assert(p);
@@ -88,41 +138,36 @@ bool LocalEngine::start(const std::string addr, const std::string port) {
   for (int t = 0; t < THREAD_NUM; t++) {
     threads.emplace_back(
       [&](int thread_id) {
-        {
-          int per_thead_work = SLOT_BITMAP_NUMS / THREAD_NUM;
-          int start_pos = thread_id * per_thead_work;
-          int end_pos = (thread_id == THREAD_NUM-1) ? SLOT_BITMAP_NUMS : (thread_id+1) * per_thead_work;
-          for (int i = start_pos; i < end_pos; i++) {
-            bitmap *p = create_bitmap(KV_NUMS/SLOT_BITMAP_NUMS);
-            assert(p);
-            slot_bitmap *sb = new slot_bitmap(p, i);
-            slot_map_[i] = sb;
-            per_thread_slot_queue_[thread_id].push(sb);
-          }
-        }
-
         {
           int per_thead_work = SHARDING_NUM / THREAD_NUM;
           int start_pos = thread_id * per_thead_work;
           int end_pos = (thread_id == THREAD_NUM-1) ? SHARDING_NUM : (thread_id+1) * per_thead_work;
 
           for (int i = start_pos; i < end_pos; i++) {
-            m_hash_map_[i].set_global_slot_array(m_hash_slot_array_);
+            m_hash_map_[i].set_global_slot_array(&m_hash_slot_array_);
+          #if !defined(USE_SIMD_HASH_MAP) && !defined(USE_LOCKFREE_HASH_MAP)
+            m_hash_map_[i].set_epoch(&m_epoch_); // shrink空出的桶segment经epoch释放
+          #endif
+          #ifdef PREFAULT_INDEX
+            m_hash_map_[i].prefault();
+          #endif
           }
 
           for (int i = start_pos; i < end_pos; i++) {
-            m_mem_pool_[i] = new RDMAMemPool(m_rdma_conn_);
+            m_mem_pool_[i] = new RDMAMemPool(m_rdma_conn_, m_page_provider_);
           }
           
           for (int i = start_pos; i < end_pos; i++) {
-          #ifdef USE_CLOCK_CACHE
+          #ifdef USE_OBJECT_CACHE
+            m_cache_[i] = new ObjectCache(OBJECT_CACHE_SIZE, m_rdma_conn_);
+          #elif defined(USE_CONCURRENT_CACHE)
+            m_cache_[i] = new ConcurrentClockCache(CACHELINE_NUMS, m_rdma_conn_);
+          #elif defined(USE_CLOCK_CACHE)
             m_cache_[i] = new ClockCache(m_rdma_conn_);
           #else
             m_cache_[i] = new LRUCache((uint64_t)CACHELINE_NUMS, m_rdma_conn_, m_mem_pool_[i]);
           #endif
           }
-
-          page_pool_[thread_id] = new std::queue<Page *>();
         }
       }, t
     );
@@ -132,27 +177,14 @@ bool LocalEngine::start(const std::string addr, const std::string port) {
     th.join();
   }
 
-  for (int i = 0; i < THREAD_NUM; i++) {
-    page_pool_[i] = new std::queue<Page *>();
-  }
-
-  for (int i = 0; i < THREAD_NUM; i++) {
-    size_t kk = 2;
-    for (size_t k = 0; k < kk; k++) {
-      uint64_t mem_start_addr = 0;
-      uint32_t rkey;
-      int ret = m_rdma_conn_->register_remote_memory(mem_start_addr, rkey, PER_ALLOC_SIZE); // 一次分配1G
-      if (ret) {
-        printf("register memory fail\n");
-        return -1;
-      }
-      uint64_t page_start_addr = mem_start_addr;
-      for (int j = 0; j < 1024; j++) {
-        page_pool_[i]->push(new Page(page_start_addr, rkey));
-        page_start_addr += RDMA_ALLOCATE_SIZE;
-      }
-    }
+#ifdef USE_BACKGROUND_THREAD
+  m_background_ = new std::thread(&LocalEngine::background_loop, this);
+#endif
+#ifdef USE_CACHE_FLUSHER
+  for (int i = 0; i < CACHE_FLUSH_THREADS; i++) {
+    m_flushers_[i] = new std::thread(&LocalEngine::flush_loop, this, i);
   }
+#endif
 
   auto time_end = TIME_NOW;
   auto time_delta = time_end - time_start;
@@ -166,6 +198,27 @@ bool LocalEngine::start(const std::string addr, const std::string port) {
  * @return {void}
  */
 void LocalEngine::stop(){
+#ifdef USE_CACHE_FLUSHER
+  m_flush_stop_ = true;
+  for (int i = 0; i < CACHE_FLUSH_THREADS; i++) {
+    if (m_flushers_[i]) {
+      m_flushers_[i]->join();
+      delete m_flushers_[i];
+      m_flushers_[i] = nullptr;
+    }
+  }
+#endif
+#ifdef USE_BACKGROUND_THREAD
+  if (m_background_) {
+    m_background_stop_ = true;
+    m_background_->join();
+    delete m_background_;
+    m_background_ = nullptr;
+  }
+#endif
+  if (m_page_provider_) {
+    m_page_provider_->stop();
+  }
     // TODO
 };
 
@@ -279,10 +332,7 @@ bool LocalEngine::encrypted(const std::string value, std::string &encrypt_value)
  */
 // 需要考虑update操作
 bool LocalEngine::write(const std::string &key, const std::string &value, bool use_aes) {
-  if (unlikely(-1 == my_thread_id)) {
-    my_thread_id = alloc_thread_id_++;
-    my_thread_id %= THREAD_NUM;
-  }
+  acquire_thread_id();
 #ifdef STATISTIC_TIME
   if (unlikely(statistic_time_ == false)) {
     statistic_time_ = true;
@@ -290,8 +340,12 @@ bool LocalEngine::write(const std::string &key, const std::string &value, bool u
     std::cout << "Current time: " << timeToString(time_p) << std::endl;
   }
 #endif
-  // hash 分区
-  int index = myhash(key) % SHARDING_NUM;
+  // hash 分区, 高32位选shard, 低位选桶, 只算一次
+  uint64_t h = kv_hash(key);
+  int index = hash_shard(h, SHARDING_NUM);
+  if (value.size() > MAX_SLOT_SIZE) {
+    return write_large(key, h, index, value, use_aes);
+  }
 
   internal_value_t internal_value;
   internal_value.size = value.size();
@@ -302,8 +356,12 @@ bool LocalEngine::write(const std::string &key, const std::string &value, bool u
   uint16_t slot_size = 0;
   bool found = false;
 
+#ifdef USE_REMOTE_COMPACTION
+  ReadLock compact_guard(m_compact_lock_[index]);
+#endif
+  epoch_guard guard(m_epoch_);
   /* check whether this key exist */
-  hash_map_slot *it = m_hash_map_[index].find(key);
+  hash_map_slot *it = m_hash_map_[index].find(key, h);
   if (!it) {
     if (m_mem_pool_[index]->get_remote_mem(internal_value, start_addr, rkey, slot_size) == false) {
       assert(false);
@@ -313,23 +371,26 @@ bool LocalEngine::write(const std::string &key, const std::string &value, bool u
     offset = ((uint32_t)internal_value.slot_id) * ((uint32_t)slot_size);
   } else {
     found = true;
+    internal_value_t old_value = it->get_value();
     /* if new_value_size <= old_value_size, 直接用原来的 addr 和 offset */
-    if (internal_value.size <= it->internal_value.size) {
-      bool ret = m_mem_pool_[index]->get_page_info(it->internal_value.page_id, start_addr, rkey, slot_size);
+    if (!is_large_value(old_value) && internal_value.size <= old_value.size) {
+      bool ret = m_mem_pool_[index]->get_page_info(old_value.page_id, start_addr, rkey, slot_size);
       assert(ret);
-      it->internal_value.size = internal_value.size;
+      m_mem_pool_[index]->note_resize(slot_size, old_value.size, internal_value.size);
+      old_value.size = internal_value.size;
     } else {
       // othrerwise, free old space and alloc new space
-      bool ret = m_mem_pool_[index]->free_slot_in_page(it->internal_value);
-      assert(ret);
-      it->internal_value.size = internal_value.size;
-      if (m_mem_pool_[index]->get_remote_mem(it->internal_value, start_addr, rkey, slot_size) == false) {
+      // 旧位置可能正被读者读取, 经epoch回收
+      retire_value(index, old_value);
+      old_value.size = internal_value.size;
+      if (m_mem_pool_[index]->get_remote_mem(old_value, start_addr, rkey, slot_size) == false) {
         assert(false);
         return false;
       }
     }
-    remote_addr = start_addr + ((uint32_t)it->internal_value.cache_line_id) * CACHELINE_SIZE;
-    offset = ((uint32_t)it->internal_value.slot_id) * ((uint32_t)slot_size);
+    it->set_value(old_value);
+    remote_addr = start_addr + ((uint32_t)old_value.cache_line_id) * CACHELINE_SIZE;
+    offset = ((uint32_t)old_value.slot_id) * ((uint32_t)slot_size);
   }
 
 #ifdef USE_AES
@@ -352,27 +413,17 @@ bool LocalEngine::write(const std::string &key, const std::string &value, bool u
     return true; /* no need to update hash map */
   }
 
+  insert_index(index, key, h, internal_value);
+  return true;
+}
+
+/* Add key to the index of shard index. */
+void LocalEngine::insert_index(int index, const std::string &key, uint64_t h, const internal_value_t &iv) {
   /* Fetch a new slot from slot_array, do not need to new. */
   /* Update the hash_map. */
-  int slot;
-  if (unlikely(nullptr == cur_slot_bitmap_)) {
-    cur_slot_bitmap_ = per_thread_slot_queue_[my_thread_id].front();
-    assert(cur_slot_bitmap_);
-    per_thread_slot_queue_[my_thread_id].pop();
-  }
-
-  for(;;) {
-    slot = get_free(cur_slot_bitmap_->bitmap_);
-    if (-1 == slot) {
-      cur_slot_bitmap_ = nullptr;
-      cur_slot_bitmap_ = per_thread_slot_queue_[my_thread_id].front();
-      assert(cur_slot_bitmap_);
-      per_thread_slot_queue_[my_thread_id].pop();
-    } else {
-      slot = cur_slot_bitmap_->bitmap_id * (KV_NUMS/SLOT_BITMAP_NUMS) + slot;
-      break;
-    }
-  }
+  int slot = m_slot_alloc_.alloc();
+  assert(slot >= 0);
+  m_hash_slot_array_.ensure(slot);
   
 
   // for (int i = 0; i < SLOT_BITMAP_NUMS; i++) {
@@ -385,10 +436,69 @@ bool LocalEngine::write(const std::string &key, const std::string &value, bool u
   //   }
   // }
   assert(slot >= 0);
-  m_hash_map_[index].insert(key, internal_value, slot);
+  m_hash_map_[index].insert(key, h, iv, slot);
+}
+
+/**
+ * @description: write a value larger than MAX_SLOT_SIZE. It gets an extent
+ *               of its own and is written to remote directly, not through
+ *               the cache. An update always writes a new extent and then
+ *               switches the index, the old place is retired like a slot.
+ * @return {bool} true for success
+ */
+bool LocalEngine::write_large(const std::string &key, uint64_t h, int index, const std::string &value, bool use_aes) {
+  if (value.size() > MAX_LARGE_VALUE_SIZE) {
+    return false;
+  }
+  const std::string *data = &value;
+#ifdef USE_AES
+  std::string encrypt_value;
+  if (use_aes) {
+    encrypted(value, encrypt_value);
+    assert(value.size() == encrypt_value.size());
+    data = &encrypt_value;
+  }
+#endif
+  uint32_t id;
+  if (!m_extents_->alloc(data->size(), id)) {
+    return false;
+  }
+  const extent_t &e = m_extents_->get(id);
+  int ret = data->size() >= DIRECT_IO_MIN_SIZE
+                ? m_rdma_conn_->remote_write_direct(data->c_str(), data->size(), e.addr, e.rkey)
+                : m_rdma_conn_->remote_write((void *)data->c_str(), data->size(), e.addr, e.rkey);
+  if (ret) {
+    m_extents_->free(id);
+    return false;
+  }
+  internal_value_t iv;
+  set_extent_id(iv, id);
+
+#ifdef USE_REMOTE_COMPACTION
+  ReadLock compact_guard(m_compact_lock_[index]);
+#endif
+  epoch_guard guard(m_epoch_);
+  hash_map_slot *it = m_hash_map_[index].find(key, h);
+  if (it) {
+    internal_value_t old_value = it->get_value();
+    it->set_value(iv);
+    retire_value(index, old_value);
+    return true;
+  }
+  insert_index(index, key, h, iv);
   return true;
 }
 
+/* The remote place of a value left the index, free it once concurrent
+   readers are gone. Call inside an epoch_guard. */
+void LocalEngine::retire_value(int index, const internal_value_t &iv) {
+  if (is_large_value(iv)) {
+    m_epoch_.retire(ExtentAllocator::reclaim_extent, m_extents_, extent_id_of(iv));
+  } else {
+    m_epoch_.retire(RDMAMemPool::reclaim_remote_slot, m_mem_pool_[index], RDMAMemPool::to_reclaim_arg(iv));
+  }
+}
+
 /**
  * @description: read value from engine via key
  * @param {string} key
@@ -403,26 +513,76 @@ bool LocalEngine::read(const std::string &key, std::string &value) {
     std::cout << "Current time: " << timeToString(time_p) << std::endl;
   }
 #endif
-  int index = myhash(key) % SHARDING_NUM;
+  uint64_t h = kv_hash(key);
+  int index = hash_shard(h, SHARDING_NUM);
 
+  epoch_guard guard(m_epoch_);
   /* 从hash表查 start_addr 和 offset */
-  hash_map_slot *it = m_hash_map_[index].find(key);
+  hash_map_slot *it = m_hash_map_[index].find(key, h);
   if (!it) {
     return false;
   }
+  return read_slot(index, it, value);
+}
+
+/**
+ * @description: read n keys at once. The index lookups of each group of
+ *               FIND_BATCH_GROUP keys are interleaved with software prefetch,
+ *               the values are then fetched one by one as in read().
+ * @param {string} *keys
+ * @param {int} n
+ * @param {string} *values
+ * @param {bool} *found  found[i] is the result of read(keys[i], values[i])
+ * @return {int}  number of keys found
+ */
+int LocalEngine::read_batch(const std::string *keys, int n, std::string *values, bool *found) {
+  uint64_t h[FIND_BATCH_GROUP];
+  int index[FIND_BATCH_GROUP];
+  hash_map_slot *it[FIND_BATCH_GROUP];
+  int found_num = 0;
+  epoch_guard guard(m_epoch_);
+  for (int base = 0; base < n; base += FIND_BATCH_GROUP) {
+    int cnt = std::min(n - base, FIND_BATCH_GROUP);
+    for (int i = 0; i < cnt; i++) {
+      h[i] = kv_hash(keys[base + i]);
+      index[i] = hash_shard(h[i], SHARDING_NUM);
+      m_hash_map_[index[i]].prefetch_bucket(h[i]);
+    }
+    for (int i = 0; i < cnt; i++)
+      m_hash_map_[index[i]].prefetch_head(h[i]);
+    for (int i = 0; i < cnt; i++)
+      it[i] = m_hash_map_[index[i]].find(keys[base + i], h[i]);
+    for (int i = 0; i < cnt; i++) {
+      found[base + i] = it[i] && read_slot(index[i], it[i], values[base + i]);
+      found_num += found[base + i];
+    }
+  }
+  return found_num;
+}
 
+/* Fetch the value described by an index slot, from cache or remote. */
+bool LocalEngine::read_slot(int index, hash_map_slot *it, std::string &value) {
   uint64_t start_addr = 0; // Page起始地址
   uint64_t remote_addr = 0; // CACHE_LINE起始地址
   uint32_t offset = 0;
   uint32_t rkey = 0;
   uint16_t slot_size = 0;
-  bool ret = m_mem_pool_[index]->get_page_info(it->internal_value.page_id, start_addr, rkey, slot_size);
+  internal_value_t iv = it->get_value();
+  if (is_large_value(iv)) {
+    // 大value不经过cache, 一次RDMA READ读进value
+    const extent_t &e = m_extents_->get(extent_id_of(iv));
+    value.resize(e.size);
+    int ret = e.size >= DIRECT_IO_MIN_SIZE ? m_rdma_conn_->remote_read_direct(&value[0], e.size, e.addr, e.rkey)
+                                           : m_rdma_conn_->remote_read(&value[0], e.size, e.addr, e.rkey);
+    return ret == 0;
+  }
+  bool ret = m_mem_pool_[index]->get_page_info(iv.page_id, start_addr, rkey, slot_size);
   assert(ret);
-  remote_addr = start_addr + ((uint32_t)it->internal_value.cache_line_id) * CACHELINE_SIZE;
-  offset = ((uint32_t)it->internal_value.slot_id) * ((uint32_t)slot_size);
-  value.resize(it->internal_value.size, '0');
+  remote_addr = start_addr + ((uint32_t)iv.cache_line_id) * CACHELINE_SIZE;
+  offset = ((uint32_t)iv.slot_id) * ((uint32_t)slot_size);
+  value.resize(iv.size, '0');
   /* 从cache读数据，如果cache miss，cache会remote read把数据读到本地再返回 */
-  if (!m_cache_[index]->Find(remote_addr, rkey, offset, it->internal_value.size, (char *)value.c_str())) {
+  if (!m_cache_[index]->Find(remote_addr, rkey, offset, iv.size, (char *)value.c_str())) {
     return false;
   }
   return true;
@@ -430,10 +590,7 @@ bool LocalEngine::read(const std::string &key, std::string &value) {
 
 /** The delete interface */
 bool LocalEngine::deleteK(const std::string &key) {
-  if (unlikely(-1 == my_thread_id)) {
-    my_thread_id = alloc_thread_id_++;
-    my_thread_id %= THREAD_NUM;
-  }
+  acquire_thread_id();
 #ifdef STATISTIC_TIME
   if (unlikely(statistic_time_ == false)) {
     statistic_time_ = true;
@@ -445,27 +602,180 @@ bool LocalEngine::deleteK(const std::string &key) {
   uint64_t remote_addr;
   uint32_t rkey;
 
-  int index = myhash(key) % SHARDING_NUM;
+  uint64_t h = kv_hash(key);
+  int index = hash_shard(h, SHARDING_NUM);
 
+#ifdef USE_REMOTE_COMPACTION
+  ReadLock compact_guard(m_compact_lock_[index]);
+#endif
+  epoch_guard guard(m_epoch_);
   /* Use the corresponding shard hash map to look for key. */
 
   // 1.delte link-list node, reutur the delete slot into bitmap
-  int kv_slot_id = m_hash_map_[index].remove(key);
+  int kv_slot_id = m_hash_map_[index].remove(key, h);
   if (-1 == kv_slot_id)
     return false;
-  hash_map_slot *delete_node = &(m_hash_slot_array_[kv_slot_id]);
-  internal_value_t iv = delete_node->internal_value;
-
-  int bitmap_id = kv_slot_id / (KV_NUMS/SLOT_BITMAP_NUMS);
-  int slot_id = kv_slot_id % (KV_NUMS/SLOT_BITMAP_NUMS);
-  put_back(slot_map_[bitmap_id]->bitmap_, slot_id);
-  if (slot_map_[bitmap_id]->bitmap_->free_cnt * 10 == KV_NUMS/SLOT_BITMAP_NUMS)
-    per_thread_slot_queue_[my_thread_id].push(slot_map_[bitmap_id]);
-  
-  // update page's bitmap and kv num, choose whether push empty page into free_list
-  bool ret = m_mem_pool_[index]->free_slot_in_page(iv);
+  hash_map_slot *delete_node = m_hash_slot_array_.at(kv_slot_id);
+  internal_value_t iv = delete_node->get_value();
+
+  // 2.index slot和remote slot等并发读者退出后再回收
+  m_epoch_.retire(reclaim_kv_slot, this, kv_slot_id);
+  retire_value(index, iv);
+  return true;
+}
 
-  return ret;
+/* Return an index slot to the slot allocator. */
+void LocalEngine::free_kv_slot(int kv_slot_id) {
+  m_hash_slot_array_.release(kv_slot_id);
+  m_slot_alloc_.free(kv_slot_id);
 }
 
+#ifdef USE_CACHE_FLUSHER
+/* Flusher thread tid: writes back the dirty lines near the LRU tail of its
+   shards, so reads and writes that miss mostly evict clean lines instead of
+   waiting for a 64KB write. Each shard has one flusher (LRUCache::Flush). */
+void LocalEngine::flush_loop(int tid) {
+  while (!m_flush_stop_) {
+    int work = 0;
+    for (int i = tid; i < SHARDING_NUM && !m_flush_stop_; i += CACHE_FLUSH_THREADS) {
+      work += m_cache_[i]->Flush();
+    }
+    if (work == 0) {
+      std::this_thread::sleep_for(std::chrono::microseconds(CACHE_FLUSH_INTERVAL_US));
+    }
+  }
+}
+#endif
+
+#ifdef USE_BACKGROUND_THREAD
+/* Background thread: sweeps the shards over and over, see compact_shard and
+   reclaim_shard. Pages emptied by compaction show up in a later round, once
+   the epoch of the moved slots passed. */
+void LocalEngine::background_loop() {
+  my_thread_id = COMPACTOR_THREAD_ID;
+  while (!m_background_stop_) {
+    uint64_t work = 0, reclaimed = 0;
+    for (int i = 0; i < SHARDING_NUM && !m_background_stop_; i++) {
+#ifdef USE_REMOTE_COMPACTION
+      work += compact_shard(i);
+#endif
+#ifdef USE_REMOTE_RECLAIM
+      reclaimed += reclaim_shard(i);
+#endif
+    }
+#ifdef USE_REMOTE_RECLAIM
+    if (reclaimed > 0) {
+      m_page_provider_->trim();
+    }
+    work += reclaimed;
+#endif
+    if (work == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(BACKGROUND_INTERVAL_MS));
+    }
+  }
+}
+#endif
+
+#ifdef USE_REMOTE_COMPACTION
+
+/**
+ * @description: evacuate the sparse pages of one shard. The keys whose
+ *               values live in a sparse page are collected with the writers
+ *               of the shard held off (memory only, no RDMA). Then each key
+ *               is moved on its own: writers are held off again only while
+ *               its value is copied (through the cache) to a slot handed
+ *               out by get_remote_mem, which prefers the dense not-full
+ *               pages. The old slots are retired, so once concurrent readers
+ *               are gone the sparse pages become empty and are reused by any
+ *               size class.
+ * @param {int} index  shard
+ * @return {int}  number of values moved
+ */
+int LocalEngine::compact_shard(int index) {
+  std::vector<Page *> victims;
+  std::vector<bool> is_victim;
+  std::vector<std::string> keys;
+  {
+    WriteLock lock(m_compact_lock_[index]);
+    m_mem_pool_[index]->collect_sparse_pages(COMPACT_SPARSE_RATIO, victims);
+    if (victims.empty()) {
+      return 0;
+    }
+    is_victim.resize(m_mem_pool_[index]->page_id_end(), false);
+    for (Page *p : victims) {
+      is_victim[p->get_page_id()] = true;
+    }
+    m_hash_map_[index].for_each([&](hash_map_slot *it) {
+      internal_value_t value = it->get_value();
+      if (!is_large_value(value) && value.page_id < is_victim.size() && is_victim[value.page_id]) {
+        keys.emplace_back(it->key, 16);
+      }
+    });
+  }
+
+  // victims 已不在分配队列里, 之后只有这些key原地更新时还会写进去
+  int moved = 0;
+  std::string buf;
+  for (const std::string &key : keys) {
+    WriteLock lock(m_compact_lock_[index]);
+    epoch_guard guard(m_epoch_);
+    hash_map_slot *it = m_hash_map_[index].find(key, kv_hash(key));
+    if (!it) {
+      continue;
+    }
+    // 收集之后被删除重插或搬到了别处
+    internal_value_t old_value = it->get_value();
+    if (is_large_value(old_value) || old_value.page_id >= is_victim.size() || !is_victim[old_value.page_id]) {
+      continue;
+    }
+    uint64_t start_addr;
+    uint32_t rkey;
+    uint16_t slot_size;
+    bool ret = m_mem_pool_[index]->get_page_info(old_value.page_id, start_addr, rkey, slot_size);
+    assert(ret);
+    buf.resize(old_value.size);
+    if (!m_cache_[index]->Find(start_addr + ((uint32_t)old_value.cache_line_id) * CACHELINE_SIZE, rkey,
+                               ((uint32_t)old_value.slot_id) * ((uint32_t)slot_size), old_value.size, &buf[0])) {
+      continue;
+    }
+    internal_value_t new_value;
+    new_value.size = old_value.size;
+    if (m_mem_pool_[index]->get_remote_mem(new_value, start_addr, rkey, slot_size) == false) {
+      continue;
+    }
+    m_cache_[index]->Insert(start_addr + ((uint32_t)new_value.cache_line_id) * CACHELINE_SIZE, rkey,
+                            ((uint32_t)new_value.slot_id) * ((uint32_t)slot_size), new_value.size, buf.c_str());
+    // 新位置的数据已在cache中, 再发布; 并发读者可能仍在读旧位置
+    it->set_value(new_value);
+    m_epoch_.retire(RDMAMemPool::reclaim_remote_slot, m_mem_pool_[index], RDMAMemPool::to_reclaim_arg(old_value));
+    moved++;
+  }
+
+  m_mem_pool_[index]->return_pages(victims);
+  return moved;
+}
+#endif
+
+#ifdef USE_REMOTE_RECLAIM
+/**
+ * @description: give the surplus empty pages of one shard back to the page
+ *               provider. Their cache lines are dropped without write back
+ *               first, nothing may be written to the remote memory once the
+ *               provider unregisters it.
+ * @param {int} index  shard
+ * @return {int}  number of pages given back
+ */
+int LocalEngine::reclaim_shard(int index) {
+  std::vector<Page *> pages;
+  m_mem_pool_[index]->trim_empty_pages(RECLAIM_KEEP_EMPTY_PAGES, pages);
+  for (Page *p : pages) {
+    for (uint32_t i = 0; i < BITMAP_NUMS; i++) {
+      m_cache_[index]->Invalidate(p->get_start_addr() + i * CACHELINE_SIZE);
+    }
+    m_page_provider_->put_page(p);
+  }
+  return pages.size();
+}
+#endif
+
 }  // namespace kv
\ No newline at end of file
@@ -0,0 +1,254 @@
+#include "page_provider.h"
+#include <stdio.h>
+#include <algorithm>
+
+namespace kv {
+
+void PageProvider::start() {
+  stop_ = false;
+  thread_ = new std::thread(&PageProvider::provision_loop, this);
+}
+
+void PageProvider::stop() {
+  if (thread_ != nullptr) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    thread_->join();
+    delete thread_;
+    thread_ = nullptr;
+  }
+  // 线程退出后才还回来的region
+  unregister_regions();
+}
+
+Page *PageProvider::get_page(int tid) {
+  Page *page = nullptr;
+  if (returned_num_.load(std::memory_order_relaxed) > 0 && reuse_pages(&page, 1) == 1) {
+    return page;
+  }
+  for (;;) {
+    if (pages_[tid].try_dequeue(page)) {
+      if (pages_[tid].size_approx() < PAGE_POOL_LOW_WATERMARK) request(tid);
+      return page;
+    }
+    // 跑空了, 先偷别的线程的page, 剩下的留在自己队列里
+    Page *stolen[PAGE_STEAL_MAX];
+    size_t n = steal_pages(tid, stolen, PAGE_STEAL_MAX, 1);
+    if (n > 0) {
+      if (n > 1) pages_[tid].enqueue_bulk(stolen + 1, n - 1);
+      return stolen[0];
+    }
+    if (exhausted_) return nullptr;
+    // 都没有, 等provisioner注册完
+    request(tid);
+    std::unique_lock<std::mutex> lock(mutex_);
+    ready_cv_.wait_for(lock, std::chrono::milliseconds(1),
+                       [&] { return pages_[tid].size_approx() > 0 || exhausted_; });
+  }
+}
+
+void PageProvider::request(int tid) {
+  if (wanted_[tid].load(std::memory_order_relaxed) || wanted_[tid].exchange(true)) return;
+  // 加锁再notify, 与provisioner的检查-等待不会错过
+  { std::lock_guard<std::mutex> lock(mutex_); }
+  cv_.notify_one();
+}
+
+bool PageProvider::any_wanted() const {
+  for (int i = 0; i < POOL_THREAD_NUM; i++) {
+    if (wanted_[i].load()) return true;
+  }
+  return false;
+}
+
+void PageProvider::provision_loop() {
+  while (!stop_) {
+    unregister_regions();
+    for (int i = 0; i < POOL_THREAD_NUM && !stop_; i++) {
+      if (!wanted_[i].load()) continue;
+      if (!provision(i)) {
+        exhausted_ = true;
+      }
+      // chunk远大于低水位, 入队后才清除请求, 期间的重复请求合并为一次
+      wanted_[i] = false;
+      { std::lock_guard<std::mutex> lock(mutex_); }
+      ready_cv_.notify_all();
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [&] { return stop_ || (!exhausted_ && any_wanted()) || unused_regions_.size_approx() > 0; });
+  }
+}
+
+/* Queue a chunk worth of pages for thread tid: returned pages if there are,
+   else register a new chunk of remote memory. */
+bool PageProvider::provision(int tid) {
+  Page *reused[REMOTE_CHUNK_SIZE / RDMA_ALLOCATE_SIZE];
+  size_t n = reuse_pages(reused, REMOTE_CHUNK_SIZE / RDMA_ALLOCATE_SIZE);
+  if (n == 0) {
+    // 别的线程攒着的page够多, 分一半过来, 不必注册
+    n = steal_pages(tid, reused, REMOTE_CHUNK_SIZE / RDMA_ALLOCATE_SIZE, 2 * PAGE_POOL_LOW_WATERMARK);
+  }
+  if (n > 0) {
+    pages_[tid].enqueue_bulk(reused, n);
+    return true;
+  }
+  if (registered_bytes_.load() + REMOTE_CHUNK_SIZE > total_limit_) {
+    printf("remote memory limit reached\n");
+    return false;
+  }
+  uint64_t mem_start_addr = 0;
+  uint32_t rkey;
+  int ret = m_rdma_conn_->register_remote_memory(mem_start_addr, rkey, REMOTE_CHUNK_SIZE);
+  if (ret) {
+    printf("register memory fail\n");
+    return false;
+  }
+  registered_bytes_ += REMOTE_CHUNK_SIZE;
+  RemoteChunk *chunk = new RemoteChunk();
+  chunk->addr = mem_start_addr;
+  std::vector<Page *> pages;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    chunks_[mem_start_addr] = chunk;
+    uint64_t page_start_addr = mem_start_addr;
+    for (uint64_t j = 0; j < REMOTE_CHUNK_SIZE / RDMA_ALLOCATE_SIZE; j++) {
+      pages.push_back(new_page(page_start_addr, rkey));
+      page_start_addr += RDMA_ALLOCATE_SIZE;
+    }
+  }
+  pages_[tid].enqueue_bulk(pages.data(), pages.size());
+  return true;
+}
+
+/* Under mutex_. */
+Page *PageProvider::new_page(uint64_t start_addr, uint32_t rkey) {
+  if (spare_pages_.empty()) {
+    return new Page(start_addr, rkey);
+  }
+  Page *page = spare_pages_.back();
+  spare_pages_.pop_back();
+  page->reset(start_addr, rkey);
+  return page;
+}
+
+/* Up to n returned pages, from the chunks that have the fewest returned:
+   the chunks that are almost all back are left to drain. */
+size_t PageProvider::reuse_pages(Page **pages, size_t n) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t got = 0;
+  while (got < n) {
+    RemoteChunk *best = nullptr;
+    for (auto &kv : chunks_) {
+      RemoteChunk *c = kv.second;
+      if (!c->returned.empty() && (best == nullptr || c->returned.size() < best->returned.size())) {
+        best = c;
+      }
+    }
+    if (best == nullptr) break;
+    while (got < n && !best->returned.empty()) {
+      pages[got++] = best->returned.back();
+      best->returned.pop_back();
+      returned_num_--;
+    }
+  }
+  return got;
+}
+
+/* Up to n pages from the queue of the thread that has the most, half of
+   what it has above min_left. */
+size_t PageProvider::steal_pages(int tid, Page **pages, size_t n, size_t min_left) {
+  int victim = -1;
+  size_t most = min_left;
+  for (int i = 1; i < POOL_THREAD_NUM; i++) {
+    int j = (tid + i) % POOL_THREAD_NUM;
+    size_t cnt = pages_[j].size_approx();
+    if (cnt > most) {
+      most = cnt;
+      victim = j;
+    }
+  }
+  if (victim == -1) return 0;
+  size_t want = std::min(n, (most - min_left + 1) / 2);
+  return pages_[victim].try_dequeue_bulk(pages, want);
+}
+
+/* 每个线程队列留下PAGE_POOL_LOW_WATERMARK个page, 只收回多出来的,
+   否则线程下次要page又得等新chunk注册 */
+void PageProvider::trim() {
+  Page *page = nullptr;
+  for (int i = 0; i < POOL_THREAD_NUM; i++) {
+    size_t cnt = pages_[i].size_approx();
+    while (cnt-- > PAGE_POOL_LOW_WATERMARK && pages_[i].try_dequeue(page)) {
+      put_page(page);
+    }
+  }
+}
+
+void PageProvider::put_page(Page *page) {
+  RemoteChunk *chunk = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto iter = chunks_.upper_bound(page->get_start_addr());
+    assert(iter != chunks_.begin());
+    --iter;
+    chunk = iter->second;
+    chunk->returned.push_back(page);
+    returned_num_++;
+    if (chunk->returned.size() < REMOTE_CHUNK_SIZE / RDMA_ALLOCATE_SIZE) {
+      return;
+    }
+    // 整个chunk都空了, 摘下来还给remote
+    chunks_.erase(iter);
+    returned_num_ -= chunk->returned.size();
+  }
+  int ret = m_rdma_conn_->unregister_remote_memory(chunk->addr);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (ret) {
+    printf("unregister memory fail\n");
+    chunks_[chunk->addr] = chunk;
+    returned_num_ += chunk->returned.size();
+    return;
+  }
+  spare_pages_.insert(spare_pages_.end(), chunk->returned.begin(), chunk->returned.end());
+  delete chunk;
+  registered_bytes_ -= REMOTE_CHUNK_SIZE;
+  exhausted_ = false; // 又有额度了
+}
+
+bool PageProvider::get_region(uint64_t size, uint64_t &addr, uint32_t &rkey) {
+  if (registered_bytes_.fetch_add(size) + size > total_limit_) {
+    registered_bytes_ -= size;
+    printf("remote memory limit reached\n");
+    return false;
+  }
+  if (m_rdma_conn_->register_remote_memory(addr, rkey, size)) {
+    registered_bytes_ -= size;
+    printf("register memory fail\n");
+    return false;
+  }
+  return true;
+}
+
+void PageProvider::put_region(uint64_t addr, uint64_t size) {
+  unused_regions_.enqueue(std::make_pair(addr, size));
+  { std::lock_guard<std::mutex> lock(mutex_); }
+  cv_.notify_one();
+}
+
+/* On the provisioning thread (or after it stopped). */
+void PageProvider::unregister_regions() {
+  std::pair<uint64_t, uint64_t> region;
+  while (unused_regions_.try_dequeue(region)) {
+    if (m_rdma_conn_->unregister_remote_memory(region.first)) {
+      printf("unregister memory fail\n");
+      continue;
+    }
+    registered_bytes_ -= region.second;
+    exhausted_ = false; // 又有额度了
+  }
+}
+
+}  // namespace kv
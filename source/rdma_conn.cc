@@ -305,6 +305,32 @@ int RDMAConnection::remote_write(void *ptr, uint64_t size, uint64_t remote_addr,
                            remote_addr, rkey);
 }
 
+/* Large transfers: register the caller's buffer for this one operation and
+   move the data with a single RDMA READ/WRITE, no copy through m_reg_buf_. */
+int RDMAConnection::remote_read_direct(void *ptr, uint64_t size,
+                                       uint64_t remote_addr, uint32_t rkey) {
+  struct ibv_mr *mr = ibv_reg_mr(m_pd_, ptr, size, IBV_ACCESS_LOCAL_WRITE);
+  if (!mr) {
+    perror("ibv_reg_mr fail");
+    return -1;
+  }
+  int ret = rdma_remote_read((uint64_t)ptr, mr->lkey, size, remote_addr, rkey);
+  ibv_dereg_mr(mr);
+  return ret;
+}
+
+int RDMAConnection::remote_write_direct(const void *ptr, uint64_t size,
+                                        uint64_t remote_addr, uint32_t rkey) {
+  struct ibv_mr *mr = ibv_reg_mr(m_pd_, (void *)ptr, size, 0);
+  if (!mr) {
+    perror("ibv_reg_mr fail");
+    return -1;
+  }
+  int ret = rdma_remote_write((uint64_t)ptr, mr->lkey, size, remote_addr, rkey);
+  ibv_dereg_mr(mr);
+  return ret;
+}
+
 int RDMAConnection::register_remote_memory(uint64_t &addr, uint32_t &rkey,
                                            uint64_t size) {
   memset(m_cmd_msg_, 0, sizeof(CmdMsgBlock));
@@ -346,4 +372,40 @@ int RDMAConnection::register_remote_memory(uint64_t &addr, uint32_t &rkey,
   return 0;
 }
 
+int RDMAConnection::unregister_remote_memory(uint64_t addr) {
+  memset(m_cmd_msg_, 0, sizeof(CmdMsgBlock));
+  memset(m_cmd_resp_, 0, sizeof(CmdMsgRespBlock));
+  m_cmd_resp_->notify = NOTIFY_IDLE;
+  UnregisterRequest *request = (UnregisterRequest *)m_cmd_msg_;
+  request->resp_addr = (uint64_t)m_cmd_resp_;
+  request->resp_rkey = m_resp_mr_->rkey;
+  request->type = MSG_UNREGISTER;
+  request->addr = addr;
+  m_cmd_msg_->notify = NOTIFY_WORK;
+
+  /* send a request to sever */
+  int ret = rdma_remote_write((uint64_t)m_cmd_msg_, m_msg_mr_->lkey,
+                              sizeof(CmdMsgBlock), m_server_cmd_msg_,
+                              m_server_cmd_rkey_);
+  if (ret) {
+    printf("fail to send requests\n");
+    return ret;
+  }
+
+  /* wait for response */
+  auto start = TIME_NOW;
+  while (m_cmd_resp_->notify == NOTIFY_IDLE) {
+    if (TIME_DURATION_US(start, TIME_NOW) > RDMA_TIMEOUT_US) {
+      printf("wait for request completion timeout\n");
+      return -1;
+    }
+  }
+  UnregisterResponse *resp_msg = (UnregisterResponse *)m_cmd_resp_;
+  if (resp_msg->status != RES_OK) {
+    printf("unregister remote memory fail\n");
+    return -1;
+  }
+  return 0;
+}
+
 }  // namespace kv
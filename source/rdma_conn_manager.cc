@@ -45,6 +45,14 @@ int ConnectionManager::register_remote_memory(uint64_t &addr, uint32_t &rkey,
   return ret;
 }
 
+int ConnectionManager::unregister_remote_memory(uint64_t addr) {
+  RDMAConnection *conn = m_rpc_conn_queue_->dequeue();
+  assert(conn != nullptr);
+  int ret = conn->unregister_remote_memory(addr);
+  m_rpc_conn_queue_->enqueue(conn);
+  return ret;
+}
+
 int ConnectionManager::remote_read(void *ptr, uint32_t size,
                                    uint64_t remote_addr, uint32_t rkey) {
   RDMAConnection *conn = m_one_sided_conn_queue_->dequeue();
@@ -63,4 +71,22 @@ int ConnectionManager::remote_write(void *ptr, uint32_t size,
   return ret;
 }
 
+int ConnectionManager::remote_read_direct(void *ptr, uint32_t size,
+                                          uint64_t remote_addr, uint32_t rkey) {
+  RDMAConnection *conn = m_one_sided_conn_queue_->dequeue();
+  assert(conn != nullptr);
+  int ret = conn->remote_read_direct(ptr, size, remote_addr, rkey);
+  m_one_sided_conn_queue_->enqueue(conn);
+  return ret;
+}
+
+int ConnectionManager::remote_write_direct(const void *ptr, uint32_t size,
+                                           uint64_t remote_addr, uint32_t rkey) {
+  RDMAConnection *conn = m_one_sided_conn_queue_->dequeue();
+  assert(conn != nullptr);
+  int ret = conn->remote_write_direct(ptr, size, remote_addr, rkey);
+  m_one_sided_conn_queue_->enqueue(conn);
+  return ret;
+}
+
 }  // namespace kv
\ No newline at end of file
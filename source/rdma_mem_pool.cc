@@ -1,9 +1,11 @@
 #include "rdma_mem_pool.h"
 #include "kv_engine.h"
+#include "page_provider.h"
 namespace kv {
 
 extern thread_local int my_thread_id;
-extern std::queue<Page*> *page_pool_[THREAD_NUM];
+
+static_assert(POOL_THREAD_NUM == THREAD_NUM + 1, "active pages are indexed by my_thread_id, COMPACTOR_THREAD_ID included");
 
 /**
  * @brief get mem from remote host
@@ -16,113 +18,278 @@ extern std::queue<Page*> *page_pool_[THREAD_NUM];
  */
 bool RDMAMemPool::get_remote_mem(internal_value_t &iv, uint64_t &page_start_addr, uint32_t &rkey, uint16_t &slot_size) {
   uint16_t size = iv.size;
-  if (size > RDMA_ALLOCATE_SIZE) 
+  if (size > MAX_SLOT_SIZE) 
     return false;
 
-  int page_index = (size == 80) ? 0 : (size - 81) / 16;
-  Page *page = nullptr;
-  slot_size = (page_index+1)*16 + 80;
-  page_info_lock_.lock_writer();
-
-retry:
-  // get slot from page
-  page = is_using_page_list_[page_index];
-  if (page == nullptr) {
-    // alloc remote Mem and new page
-    // int ret = m_rdma_conn_->register_remote_memory(page_start_addr, rkey, RDMA_ALLOCATE_SIZE);
-    // if (ret) {
-    //   printf("register memory fail\n");
-    //   page_info_lock_.unlock_writer();
-    //   return -1;
-    // }
-    page_id_t page_id = alloc_page_id_++;
-    assert(page_id < MAX_PAGE_NUMS);
-    // page = new Page(page_id, page_start_addr, slot_size, rkey);
-    page = page_pool_[my_thread_id]->front();
-    assert(page);
-    page_pool_[my_thread_id]->pop();
-    page->format_newpage(page_id, slot_size);
-    page_map_[page_id] = page;
-    page_start_addr = page->get_start_addr();
-    rkey = page->get_rkey();
+  const size_class_table *classes = classes_.load(std::memory_order_acquire);
+  int page_index = classes->class_of_size(size);
+  slot_size = classes->slot_size[page_index];
+#ifdef USE_ADAPTIVE_SIZE_CLASS
+  sample_size(my_thread_id, size);
+#endif
+
+  thread_stat &st = stats_[my_thread_id];
+  if (st.version != classes->version) {
+    release_stale_pages(my_thread_id, classes);
+    st.version = classes->version;
+  }
+
+  // fast path: 只有本线程从自己的active page分配, page的bitmap是CAS的, 不加锁
+  Page *&page = active_page_[my_thread_id][page_index];
+  page_id_t page_id;
+  cache_id_t cache_line_id;
+  slot_id_t slot_id;
+  while (page == nullptr || !page->get_free_slot(page_id, cache_line_id, slot_id)) {
+    if (page != nullptr)
+      release_page(page);
+    page = refill_page(slot_size);
+    if (page == nullptr) {
+      return false; // remote内存用完了
+    }
+  }
+  iv.page_id = page_id;
+  iv.cache_line_id = cache_line_id;
+  iv.slot_id = slot_id;
+  page_start_addr = page->get_start_addr();
+  rkey = page->get_rkey();
+
+  st.live[slot_size / SLOT_GRANULE]++;
+  st.waste[slot_size / SLOT_GRANULE] += slot_size - size;
+  return true;
+}
+
+/* The thread gives up its active page (it is full). If frees already brought
+   it under the threshold meanwhile, nobody else would queue it, do it here. */
+void RDMAMemPool::release_page(Page *page) {
+  page->in_use_.store(false, std::memory_order_seq_cst);
+  if (page->is_notfull() && !page->queued_.exchange(true)) {
+    notfull_page_list_[page->get_slot_size() / SLOT_GRANULE].enqueue(page);
+  }
+}
+
+/* The size classes changed since the thread last allocated: give back the
+   active pages that do not match their class any more. */
+void RDMAMemPool::release_stale_pages(int tid, const size_class_table *classes) {
+  for (int i = 0; i < PAGE_LEVELS; i++) {
+    Page *&page = active_page_[tid][i];
+    if (page != nullptr && (i >= classes->num || page->get_slot_size() != classes->slot_size[i])) {
+      release_page(page);
+      page = nullptr;
+    }
+  }
+}
+
+/* Take a page for a thread's active slot of size class slot_size: a not-full
+   page of this class, else an empty page reformatted to slot_size, else a
+   new page from the page provider. nullptr if remote memory is exhausted. */
+Page *RDMAMemPool::refill_page(uint16_t slot_size) {
+  Page *pp = nullptr;
+  while (notfull_page_list_[slot_size / SLOT_GRANULE].try_dequeue(pp)) {
+    assert(pp);
+    // 先占住再出队列标记, 否则free_slot_in_page可能看到两者都为false, 把它又放回队列
+    pp->in_use_.store(true, std::memory_order_seq_cst);
+    pp->queued_.store(false, std::memory_order_seq_cst);
+    if (pp->is_empty()) {
+      // 空页可以给任意size class使用
+      pp->in_use_.store(false);
+      bool res = empty_page_list.enqueue(pp);
+      assert(res);
+      continue;
+    }
+    return pp;
+  }
+  if (empty_page_list.try_dequeue(pp) || (reclaim_retired_pages() && empty_page_list.try_dequeue(pp))) {
+    assert(pp);
+    pp->format_page(slot_size);
+    pp->in_use_.store(true);
+    return pp;
+  }
+  // alloc remote Mem and new page
+  pp = m_page_provider_->get_page(my_thread_id);
+  if (pp == nullptr) {
+    return nullptr;
+  }
+  page_id_t page_id;
+  if (!free_page_ids_.try_dequeue(page_id)) {
+    page_id = alloc_page_id_++;
+  }
+  assert(page_id < MAX_PAGE_NUMS);
+  pp->format_newpage(page_id, slot_size);
+  set_page(page_id, pp);
 #ifdef STATIC_REMOTE_MEM_USE
-    remote_mem_use += RDMA_ALLOCATE_SIZE; 
+  remote_mem_use += RDMA_ALLOCATE_SIZE; 
 #endif
-    Page *old = nullptr;
-    bool res = is_using_page_list_[page_index].compare_exchange_strong(old, page, std::memory_order_acquire);
-    if (false == res){
-      assert(false); // tmp不可能出现
-      // CAS失败，放入empty_page_list
-      empty_page_list.enqueue(page);
-      page = is_using_page_list_[page_index];
-      assert(page);
+  pp->in_use_.store(true);
+  return pp;
+}
+
+/* Enter page into the page table, the leaf is created on first use. */
+void RDMAMemPool::set_page(page_id_t page_id, Page *page) {
+  std::atomic<Page **> &slot = page_dir_[page_id >> PAGE_TABLE_LEAF_BITS];
+  Page **leaf = slot.load(std::memory_order_acquire);
+  if (leaf == nullptr) {
+    Page **fresh = (Page **)calloc(PAGE_TABLE_LEAF_SIZE, sizeof(Page *));
+    if (slot.compare_exchange_strong(leaf, fresh, std::memory_order_acq_rel)) {
+      leaf = fresh;
+    } else {
+      free(fresh); // 别的线程先装好了
     }
-    
-    res = page->get_free_slot(iv.page_id, iv.cache_line_id, iv.slot_id);
-    assert(res);
-  } else {
-    if (false == page->get_free_slot(iv.page_id, iv.cache_line_id, iv.slot_id)) {
-      // first. lookup notfull_page_list_
-      // second. lookup empty_page_list
-redo2:
-      Page *pp = nullptr;
-      if (notfull_page_list_[page_index].try_dequeue(pp)) {
-        assert(pp);
-        if (pp->is_empty()) {
-          bool res = empty_page_list.enqueue(pp);
-          assert(res);
-          goto redo2;
-        } else {
-          bool res = is_using_page_list_[page_index].compare_exchange_strong(page, pp, std::memory_order_acquire);
-          if (false == res){
-            assert(false); // tmp不可能出现
-            // CAS失败，放回notfull_page_list_
-            res = notfull_page_list_[page_index].enqueue(pp);
-            assert(res);
-          }
-        }
-      } else if (empty_page_list.try_dequeue(pp)) {
-        assert(pp);
-        pp->format_page(slot_size);
-        bool res = is_using_page_list_[page_index].compare_exchange_strong(page, pp, std::memory_order_acquire);
-         if (false == res){
-          assert(false); // tmp不可能出现
-          // CAS失败，放回empty_page_list
-          res = empty_page_list.enqueue(pp);
-          assert(res);
-        }
+  }
+  leaf[page_id & (PAGE_TABLE_LEAF_SIZE - 1)] = page;
+}
+
+/* Pages whose slot size is no longer a size class are not handed out again,
+   they wait in their queue until the last value in them goes away. Move the
+   ones that are empty by now to empty_page_list, before a new page is taken. */
+bool RDMAMemPool::reclaim_retired_pages() {
+  const size_class_table *classes = classes_.load(std::memory_order_acquire);
+  bool found = false;
+  for (int g = 0; g < SLOT_GRANULES; g++) {
+    if (classes->index_of[g] >= 0)
+      continue;
+    size_t n = notfull_page_list_[g].size_approx();
+    Page *pp = nullptr;
+    for (size_t i = 0; i < n && notfull_page_list_[g].try_dequeue(pp); i++) {
+      if (pp->is_empty()) {
+        // 不是active page也不在free中途, 空了就不会再变
+        pp->queued_.store(false);
+        empty_page_list.enqueue(pp);
+        found = true;
       } else {
-        assert(pp == nullptr);
-        is_using_page_list_[page_index].compare_exchange_strong(page, pp, std::memory_order_acquire);
+        notfull_page_list_[g].enqueue(pp);
       }
-      goto retry;
     }
-    page_start_addr = page->get_start_addr();
-    rkey = page->get_rkey();
   }
-
-  page_info_lock_.unlock_writer();
-  return true;
+  return found;
 }
 
 bool RDMAMemPool::free_slot_in_page(const internal_value_t &iv) {
-  Page *page = page_map_[iv.page_id];
+  Page *page = page_at(iv.page_id);
   if (nullptr == page) {
     return false;
   }
-  page_info_lock_.lock_writer();
-  int page_index = (page->get_slot_size()-80)/16 - 1;
+  uint16_t slot_size = page->get_slot_size();
+  thread_stat &st = stats_[my_thread_id];
+  st.live[slot_size / SLOT_GRANULE]--;
+  st.waste[slot_size / SLOT_GRANULE] -= slot_size - iv.size;
+
   bool ret = page->free_slot(iv.cache_line_id, iv.slot_id);
   //页空余达到比例且不为正在使用的page, 放入not_full_page_list备用
-  if (true == ret && page != is_using_page_list_[page_index]) {
-    notfull_page_list_[page_index].enqueue(page);
+  //与release_page配合: 两边都先改各自的状态再检查对方, 至少一方会入队
+  if (true == ret && !page->in_use_.load(std::memory_order_seq_cst) && !page->queued_.exchange(true)) {
+    notfull_page_list_[slot_size / SLOT_GRANULE].enqueue(page);
   }
-  page_info_lock_.unlock_writer();
   return true;
 }
 
+void RDMAMemPool::note_resize(uint16_t slot_size, uint16_t old_size, uint16_t new_size) {
+  stats_[my_thread_id].waste[slot_size / SLOT_GRANULE] += old_size - new_size;
+}
+
+#ifdef USE_ADAPTIVE_SIZE_CLASS
+/* Every 2^SIZE_CLASS_SAMPLE_SHIFT-th allocation of a thread feeds the value
+   size histogram, every SIZE_CLASS_REBUILD_SAMPLES samples the classes are
+   recomputed. */
+void RDMAMemPool::sample_size(int tid, uint32_t size) {
+  if (++stats_[tid].tick & ((1u << SIZE_CLASS_SAMPLE_SHIFT) - 1))
+    return;
+  size_hist_[size_granule(size)].fetch_add(1, std::memory_order_relaxed);
+  if ((samples_.fetch_add(1, std::memory_order_relaxed) + 1) % SIZE_CLASS_REBUILD_SAMPLES == 0)
+    rebuild_size_classes();
+}
+
+/* Install the classes of minimal slack for the sampled sizes if they beat
+   the current ones clearly, then halve the histogram so it follows the
+   workload. Each class is charged half an active page per thread. Pages of
+   dropped classes drain through reclaim_retired_pages (or are evacuated by
+   the compactor), values are never moved here. */
+void RDMAMemPool::rebuild_size_classes() {
+  if (rebuilding_.exchange(true))
+    return;
+  uint64_t hist[SLOT_GRANULES];
+  for (int g = 0; g < SLOT_GRANULES; g++) {
+    hist[g] = size_hist_[g].load(std::memory_order_relaxed);
+  }
+  const double scale = SLOT_GRANULE << SIZE_CLASS_SAMPLE_SHIFT;
+  const double class_cost = POOL_THREAD_NUM * (double)RDMA_ALLOCATE_SIZE / 2;
+  size_class_table *cur = classes_.load(std::memory_order_relaxed);
+  size_class_table *t = size_class_table::optimal(hist, scale, class_cost);
+  if (t && !t->same_classes(*cur) &&
+      t->cost(hist, scale, class_cost) < cur->cost(hist, scale, class_cost) * SIZE_CLASS_MIN_GAIN) {
+    t->version = cur->version + 1;
+    tables_.push_back(t);
+    classes_.store(t, std::memory_order_release);
+  } else {
+    delete t;
+  }
+  for (int g = 0; g < SLOT_GRANULES; g++) {
+    size_hist_[g].fetch_sub(hist[g] / 2, std::memory_order_relaxed);
+  }
+  rebuilding_.store(false);
+}
+#endif
+
+void RDMAMemPool::collect_sparse_pages(double ratio, std::vector<Page *> &victims) {
+  const size_class_table *classes = classes_.load(std::memory_order_acquire);
+  for (int g = 0; g < SLOT_GRANULES; g++) {
+    // 不再是size class的page不论占用多少都搬空
+    bool retired = classes->index_of[g] < 0;
+    std::vector<Page *> keep;
+    Page *pp = nullptr;
+    while (notfull_page_list_[g].try_dequeue(pp)) {
+      // 同refill_page, 先占住再清出队列标记
+      pp->in_use_.store(true, std::memory_order_seq_cst);
+      pp->queued_.store(false, std::memory_order_seq_cst);
+      if (pp->is_empty()) {
+        pp->in_use_.store(false);
+        empty_page_list.enqueue(pp);
+      } else if (retired || pp->get_kv_nums() < pp->get_capacity() * ratio) {
+        victims.push_back(pp);
+      } else {
+        keep.push_back(pp);
+      }
+    }
+    for (Page *p : keep) release_page(p);
+  }
+}
+
+void RDMAMemPool::return_pages(const std::vector<Page *> &pages) {
+  for (Page *p : pages) {
+    release_page(p);
+  }
+}
+
+void RDMAMemPool::trim_empty_pages(size_t keep, std::vector<Page *> &pages) {
+  size_t n = empty_page_list.size_approx();
+  Page *pp = nullptr;
+  for (; n > keep && empty_page_list.try_dequeue(pp); n--) {
+    // 空page没有live的value, 也没有待回收的slot, 不会再有人通过page_id访问
+    page_id_t page_id = pp->get_page_id();
+    set_page(page_id, nullptr);
+    pp->release();
+    free_page_ids_.enqueue(page_id);
+#ifdef STATIC_REMOTE_MEM_USE
+    remote_mem_use -= RDMA_ALLOCATE_SIZE;
+#endif
+    pages.push_back(pp);
+  }
+}
+
+void RDMAMemPool::page_stats(uint32_t &page_num, uint64_t &used_bytes) {
+  uint32_t ids = alloc_page_id_.load();
+  page_num = 0;
+  used_bytes = 0;
+  for (uint32_t i = 0; i < ids; i++) {
+    Page *p = page_at(i);
+    if (p) {
+      page_num++;
+      used_bytes += (uint64_t)p->get_kv_nums() * p->get_slot_size();
+    }
+  }
+}
+
 bool RDMAMemPool::get_page_info(page_id_t page_id, uint64_t &start_addr, uint32_t &rkey, uint16_t &slot_size) {
-  Page *page = page_map_[page_id];
+  Page *page = page_at(page_id);
   if (nullptr == page) {
     return false;
   }
@@ -132,8 +299,24 @@ bool RDMAMemPool::get_page_info(page_id_t page_id, uint64_t &start_addr, uint32_
   return true;
 }
 
+void RDMAMemPool::class_stats(int64_t *live, int64_t *waste) {
+  for (int t = 0; t < POOL_THREAD_NUM; t++) {
+    for (int g = 0; g < SLOT_GRANULES; g++) {
+      live[g] += stats_[t].live[g];
+      waste[g] += stats_[t].waste[g];
+    }
+  }
+}
+
 void RDMAMemPool::destory() {
   // TODO: release allocated resources
+  for (size_class_table *t : tables_) {
+    delete t;
+  }
+  tables_.clear();
+  for (int i = 0; i < PAGE_TABLE_DIR_SIZE; i++) {
+    free(page_dir_[i].exchange(nullptr));
+  }
 }
 
 }  // namespace kv
\ No newline at end of file
@@ -100,6 +100,12 @@ void RemoteEngine::stop() {
       m_worker_threads_[i] = nullptr;
     }
   }
+  // client没有归还的内存
+  for (auto &kv : m_regions_) {
+    ibv_dereg_mr(kv.second.mr);
+    free(kv.second.mem);
+  }
+  m_regions_.clear();
   // TODO: release resources
 }
 
@@ -238,17 +244,43 @@ int RemoteEngine::allocate_and_register_memory(uint64_t &addr, uint32_t &rkey,
   /* align mem */
   uint64_t total_size = size + MEM_ALIGN_SIZE;
   uint64_t mem = (uint64_t)malloc(total_size);
+  if (mem == 0) {
+    perror("malloc fail");
+    return -1;
+  }
   addr = mem;
   if (addr % MEM_ALIGN_SIZE != 0)
     addr = addr + (MEM_ALIGN_SIZE - addr % MEM_ALIGN_SIZE);
   struct ibv_mr *mr = rdma_register_memory((void *)addr, size);
   if (!mr) {
     perror("ibv_reg_mr fail");
+    free((void *)mem);
     return -1;
   }
   rkey = mr->rkey;
   // printf("allocate and register memory %ld %d\n", addr, rkey);
-  // TODO: save this memory info for later delete
+  std::lock_guard<std::mutex> lock(m_region_lock_);
+  m_regions_[addr] = RemoteRegion{(void *)mem, mr, size};
+  return 0;
+}
+
+/* Release a region handed out by allocate_and_register_memory, addr is the
+   address the client got. Returns -1 if no such region. */
+int RemoteEngine::deregister_and_free_memory(uint64_t addr) {
+  RemoteRegion region;
+  {
+    std::lock_guard<std::mutex> lock(m_region_lock_);
+    auto iter = m_regions_.find(addr);
+    if (iter == m_regions_.end()) {
+      return -1;
+    }
+    region = iter->second;
+    m_regions_.erase(iter);
+  }
+  if (ibv_dereg_mr(region.mr)) {
+    perror("ibv_dereg_mr fail");
+  }
+  free(region.mem);
   return 0;
 }
 
@@ -341,9 +373,19 @@ void RemoteEngine::worker(WorkerInfo *work_info, uint32_t num) {
     } else if (request->type == MSG_UNREGISTER) {
       /* handle memory unregister requests */
       UnregisterRequest *unreg_req = (UnregisterRequest *)request;
-      printf("receive a memory unregister message, addr: %ld\n",
-             unreg_req->addr);
-      // TODO: implemente memory unregister
+      // printf("receive a memory unregister message, addr: %ld\n",
+      //        unreg_req->addr);
+      UnregisterResponse *resp_msg = (UnregisterResponse *)cmd_resp;
+      if (deregister_and_free_memory(unreg_req->addr)) {
+        printf("unregister unknown memory, addr: %ld\n", unreg_req->addr);
+        resp_msg->status = RES_FAIL;
+      } else {
+        resp_msg->status = RES_OK;
+      }
+      /* write response */
+      remote_write(work_info, (uint64_t)cmd_resp, resp_mr->lkey,
+                   sizeof(CmdMsgRespBlock), unreg_req->resp_addr,
+                   unreg_req->resp_rkey);
     } else {
       printf("wrong request type\n");
     }